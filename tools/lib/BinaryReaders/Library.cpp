@@ -34,10 +34,14 @@
  */
 
 #include "Library.h"
+#include "SymbolDatabase.h"
+#include <lib/Utils/ThreadPool.h>
 
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cctype>
 
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Path.h"
@@ -48,6 +52,10 @@
 namespace {
     llvm::cl::opt<unsigned>
             KernelStart("os", llvm::cl::desc("Start address of kernel space"),llvm::cl::init(0x80000000));
+
+    llvm::cl::opt<bool>
+            UseSymbolDatabase("symdb", llvm::cl::desc("Cache the debug information of each module in a <module>.symdb file"),
+                              llvm::cl::init(true));
 }
 
 namespace s2etools {
@@ -62,11 +70,19 @@ uint64_t Library::translatePid(uint64_t pid, uint64_t pc)
 
 Library::Library()
 {
-
+    m_fileIndexBuilt = false;
+    m_prefetcher = NULL;
 }
 
 Library::~Library()
 {
+    if (m_prefetcher) {
+        m_prefetcher->wait();
+        delete m_prefetcher;
+    }
+
+    saveSymbolDatabases();
+
     ModuleNameToExec::iterator it;
     for(it = m_libraries.begin(); it != m_libraries.end(); ++it) {
         delete (*it).second;
@@ -75,52 +91,120 @@ Library::~Library()
 
 void Library::addPath(const std::string &path)
 {
+    llvm::sys::ScopedLock lock(m_lock);
     m_libpath.push_back(path);
+
+    //Modules that were not found may be in the new path
+    m_fileIndexBuilt = false;
+    m_resolvedFiles.clear();
+    m_debugInfo.clear();
+    saveSymbolDatabases();
 }
 
 void Library::setPaths(const PathList &s)
 {
+    llvm::sys::ScopedLock lock(m_lock);
     m_libpath.clear();
     m_libpath = s;
+    m_fileIndexBuilt = false;
+    m_resolvedFiles.clear();
+    m_debugInfo.clear();
+    saveSymbolDatabases();
 }
 
-//Cycles through the list of paths and attempts to find the specified library
-bool Library::findLibrary(const std::string &libName, std::string &abspath)
+#ifdef _WIN32
+static std::string getIndexKey(const std::string &fileName)
 {
-    PathList::const_iterator it;
+    std::string key = fileName;
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    return key;
+}
+#else
+static const std::string &getIndexKey(const std::string &fileName)
+{
+    return fileName;
+}
+#endif
 
+//Lists the module directories once, instead of checking
+//each of them for every file that is looked up
+void Library::buildFileIndex()
+{
+    m_fileIndex.clear();
+
+    PathList::const_iterator it;
     for (it = m_libpath.begin(); it != m_libpath.end(); ++it) {
-        llvm::sys::Path lib(*it);
-        lib.appendComponent(libName);
+        llvm::error_code ec;
+        llvm::sys::fs::directory_iterator dit(*it, ec), dend;
+        while (!ec && dit != dend) {
+            const std::string &path = dit->path();
+            std::string name = llvm::sys::path::filename(path);
+            m_fileIndex.insert(std::make_pair(getIndexKey(name), path));
+            dit.increment(ec);
+        }
+    }
+
+    m_fileIndexBuilt = true;
+}
+
+//Cycles through the list of paths and attempts to find the specified file.
+//Both found and missing files are remembered.
+bool Library::findFile(const std::string &fileName, std::string &abspath)
+{
+    llvm::sys::ScopedLock lock(m_lock);
+
+    FileNameToPath::const_iterator it = m_resolvedFiles.find(fileName);
+    if (it != m_resolvedFiles.end()) {
+        abspath = (*it).second;
+        return !abspath.empty();
+    }
 
-        bool exists = false;
-        llvm::sys::fs::exists(lib.str(), exists);
+    std::string path;
 
-        if (exists) {
-            abspath = lib.str();
-            return true;
+    if (fileName.find_first_of("\\/") == std::string::npos) {
+        if (!m_fileIndexBuilt) {
+            buildFileIndex();
+        }
+
+        it = m_fileIndex.find(getIndexKey(fileName));
+        if (it != m_fileIndex.end()) {
+            path = (*it).second;
+        }
+    } else {
+        //Relative paths are not in the index
+        PathList::const_iterator pit;
+        for (pit = m_libpath.begin(); pit != m_libpath.end(); ++pit) {
+            llvm::sys::Path lib(*pit);
+            lib.appendComponent(fileName);
+
+            bool exists = false;
+            llvm::sys::fs::exists(lib.str(), exists);
+            if (exists) {
+                path = lib.str();
+                break;
+            }
         }
     }
-    return false;
+
+    m_resolvedFiles[fileName] = path;
+    abspath = path;
+    return !path.empty();
 }
 
-bool Library::findSuffixedModule(const std::string &moduleName, const std::string &suffix, llvm::sys::Path &path)
+bool Library::findLibrary(const std::string &libName, std::string &abspath)
 {
-    PathList::const_iterator it;
+    return findFile(libName, abspath);
+}
 
-    for (it = m_libpath.begin(); it != m_libpath.end(); ++it) {
-        llvm::sys::Path list(*it);
-        list.appendComponent(moduleName);
-        list.appendSuffix(suffix);
-
-        bool exists = false;
-        llvm::sys::fs::exists(list.str(), exists);
-        if (exists) {
-            path = list;
-            return true;
-        }
+bool Library::findSuffixedModule(const std::string &moduleName, const std::string &suffix, llvm::sys::Path &path)
+{
+    std::string abspath;
+    if (!findFile(moduleName + "." + suffix, abspath)) {
+        return false;
     }
-    return false;
+
+    path = llvm::sys::Path(abspath);
+    return true;
 }
 
 bool Library::findBasicBlockList(const std::string &moduleName, llvm::sys::Path &path)
@@ -147,20 +231,51 @@ bool Library::addLibrary(const std::string &libName)
     return addLibraryAbs(s);
 }
 
+//Returns true if the library was already opened, sets result
+//to the outcome of the attempt
+static bool isOpened(const Library::ModuleNameToExec &libraries,
+                     const Library::StringSet &badLibraries,
+                     const std::string &libName, bool &result)
+{
+    if (libraries.find(libName) != libraries.end()) {
+        result = true;
+        return true;
+    }
+
+    if (badLibraries.find(libName) != badLibraries.end()) {
+        result = false;
+        return true;
+    }
+
+    return false;
+}
+
 //Add a library using an absolute path
 bool Library::addLibraryAbs(const std::string &libName)
 {
-    if (m_libraries.find(libName) != m_libraries.end()) {
-        return true;
+    bool result;
+
+    {
+        llvm::sys::ScopedLock lock(m_lock);
+        if (isOpened(m_libraries, m_badLibraries, libName, result)) {
+            return result;
+        }
     }
 
-    if (m_badLibraries.find(libName) != m_badLibraries.end()) {
-        return false;
+    //The module may have been opened by another thread in the meantime
+    llvm::sys::ScopedLock bfdLock(m_bfdLock);
+    {
+        llvm::sys::ScopedLock lock(m_lock);
+        if (isOpened(m_libraries, m_badLibraries, libName, result)) {
+            return result;
+        }
     }
 
     std::string ProgFile = libName;
 
     s2etools::ExecutableFile *exec = s2etools::ExecutableFile::create(ProgFile);
+
+    llvm::sys::ScopedLock lock(m_lock);
     if (!exec) {
         m_badLibraries.insert(ProgFile);
         return false;
@@ -182,6 +297,7 @@ ExecutableFile *Library::get(const std::string &name)
         return NULL;
     }
 
+    llvm::sys::ScopedLock lock(m_lock);
     ModuleNameToExec::const_iterator it = m_libraries.find(s);
     if (it == m_libraries.end()) {
 
@@ -191,20 +307,159 @@ ExecutableFile *Library::get(const std::string &name)
     return (*it).second;
 }
 
+//Returns the symbol database of the module, NULL if the module
+//cannot be found. Must be called with m_lock held.
+SymbolDatabase *Library::getSymbolDatabase(const std::string &modName)
+{
+    if (!UseSymbolDatabase) {
+        return NULL;
+    }
+
+    ModuleToSymbolDatabase::const_iterator it = m_symbolDatabases.find(modName);
+    if (it != m_symbolDatabases.end()) {
+        return (*it).second;
+    }
+
+    SymbolDatabase *db = NULL;
+    std::string path;
+    if (findLibrary(modName, path)) {
+        db = new SymbolDatabase();
+        db->open(path);
+    }
+
+    m_symbolDatabases[modName] = db;
+    return db;
+}
+
+void Library::saveSymbolDatabases()
+{
+    ModuleToSymbolDatabase::iterator it;
+    for (it = m_symbolDatabases.begin(); it != m_symbolDatabases.end(); ++it) {
+        SymbolDatabase *db = (*it).second;
+        if (!db) {
+            continue;
+        }
+        //The databases are only an optimization, and the module
+        //directory may be read-only. Failing to write them is not an error.
+        db->save();
+        delete db;
+    }
+    m_symbolDatabases.clear();
+}
+
+//Looks up the debug information of an address, querying the symbol
+//database or the executable file only the first time.
+//m_lock is released while the executable file is read.
+Library::DebugInfo Library::getDebugInfo(const std::string &modName, uint64_t reladdr)
+{
+    std::string source, function;
+    uint64_t line = 0;
+    bool found = false;
+    bool cached = false;
+
+    {
+        llvm::sys::ScopedLock lock(m_lock);
+
+        AddressToDebugInfo &infos = m_debugInfo[modName];
+        AddressToDebugInfo::const_iterator it = infos.find(reladdr);
+        if (it != infos.end()) {
+            return (*it).second;
+        }
+
+        SymbolDatabase *db = getSymbolDatabase(modName);
+        cached = db && db->lookup(reladdr, found, source, line, function);
+    }
+
+    ExecutableFile *exec = NULL;
+    if (!cached) {
+        exec = get(modName);
+        if (exec) {
+            llvm::sys::ScopedLock bfdLock(m_bfdLock);
+            found = exec->getInfo(reladdr, source, line, function);
+        }
+    }
+
+    llvm::sys::ScopedLock lock(m_lock);
+
+    //The database may have been saved while the lock was released
+    SymbolDatabase *db = exec ? getSymbolDatabase(modName) : NULL;
+    if (db) {
+        db->add(reladdr, found, source, line, function);
+    }
+
+    DebugInfo info;
+    info.file = NULL;
+    info.function = NULL;
+    info.line = 0;
+
+    if (found) {
+        info.file = &*m_debugStrings.insert(source).first;
+        info.function = &*m_debugStrings.insert(function).first;
+        info.line = line;
+    }
+
+    return m_debugInfo[modName][reladdr] = info;
+}
+
+struct Library::PrefetchTask: public ThreadPoolTask
+{
+    Library *library;
+    std::string modName;
+
+    PrefetchTask(Library *l, const std::string &name) {
+        library = l;
+        modName = name;
+    }
+
+    void run() {
+        library->get(modName);
+        delete this;
+    }
+};
+
+void Library::prefetch(const std::string &modName)
+{
+    if (ThreadPool::getDefaultThreadCount() <= 1) {
+        return;
+    }
+
+    {
+        llvm::sys::ScopedLock lock(m_lock);
+        if (!m_prefetcher) {
+            //libbfd is not thread-safe, one thread is enough
+            m_prefetcher = new ThreadPool(1);
+        }
+    }
+
+    m_prefetcher->submit(new PrefetchTask(this, modName));
+}
+
+void Library::onModuleLoad(const s2e::plugins::ExecutionTraceModuleLoad &load)
+{
+    prefetch(load.name);
+}
+
+void Library::prefetchModules(LogParser *parser)
+{
+    parser->onModuleLoad.connect(
+            sigc::mem_fun(*this, &Library::onModuleLoad)
+    );
+}
+
 bool Library::getInfo(const ModuleInstance *mi, uint64_t pc, std::string &file, uint64_t &line, std::string &func)
 {
     if(!mi)
         return false;
-    ExecutableFile *exec = get(mi->Name);
-    if (!exec) {
-        return false;
-    }
 
     uint64_t reladdr = pc - mi->LoadBase + mi->ImageBase;
-    if (!exec->getInfo(reladdr, file, line, func)) {
+    DebugInfo info = getDebugInfo(mi->Name, reladdr);
+    if (!info.file) {
         return false;
     }
 
+    file = *info.file;
+    line = info.line;
+    func = *info.function;
     return true;
 }
 
@@ -213,31 +468,24 @@ bool Library::print(
         const std::string &modName, uint64_t loadBase, uint64_t imageBase,
         uint64_t pc, std::string &out, bool file, bool line, bool func)
 {
-
-    ExecutableFile *exec = get(modName);
-    if (!exec) {
-        return false;
-    }
-
     uint64_t reladdr = pc - loadBase + imageBase;
-    std::string source, function;
-    uint64_t ln;
-    if (!exec->getInfo(reladdr, source, ln, function)) {
+    DebugInfo info = getDebugInfo(modName, reladdr);
+    if (!info.file) {
         return false;
     }
 
     std::stringstream ss;
 
     if (file) {
-        ss << source;
+        ss << *info.file;
     }
 
     if (line) {
-        ss << ":" << ln;
+        ss << ":" << info.line;
     }
 
     if (func) {
-        ss << " - " << function;
+        ss << " - " << *info.function;
     }
 
     out = ss.str();
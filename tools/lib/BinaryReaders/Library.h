@@ -40,7 +40,9 @@
 #include "ExecutableFile.h"
 
 #include "lib/ExecutionTracer/ModuleParser.h"
+#include "lib/ExecutionTracer/LogParser.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Mutex.h"
 
 #include <string>
 #include <set>
@@ -49,6 +51,9 @@
 namespace s2etools
 {
 
+class SymbolDatabase;
+class ThreadPool;
+
 class Library
 {
 public:
@@ -64,6 +69,12 @@ public:
 
     ExecutableFile *get(const std::string &name);
 
+    //Opens the module in the background, if several threads are allowed
+    void prefetch(const std::string &modName);
+
+    //Prefetches the modules of the trace as soon as the parser finds them
+    void prefetchModules(LogParser *parser);
+
     void addPath(const std::string &s);
     void setPaths(const PathList &s);
 
@@ -83,11 +94,62 @@ public:
 
     static uint64_t translatePid(uint64_t pid, uint64_t pc);
 private:
+    //Debug information of an address, file is NULL if there is none.
+    //The strings are interned in m_debugStrings.
+    struct DebugInfo {
+        const std::string *file;
+        const std::string *function;
+        uint64_t line;
+    };
+
+    typedef std::map<uint64_t, DebugInfo> AddressToDebugInfo;
+    typedef std::map<std::string, AddressToDebugInfo> ModuleToDebugInfo;
+    typedef std::map<std::string, SymbolDatabase*> ModuleToSymbolDatabase;
+    typedef std::map<std::string, std::string> FileNameToPath;
+
     PathList m_libpath;
     //std::string m_libpath;
     ModuleNameToExec m_libraries;
     StringSet m_badLibraries;
 
+    //Names of the files in the module directories. Earlier directories
+    //take precedence, like when searching them one after the other.
+    FileNameToPath m_fileIndex;
+    bool m_fileIndexBuilt;
+
+    //Results of findLibrary and findSuffixedModule, indexed by file name.
+    //Missing files map to an empty path.
+    FileNameToPath m_resolvedFiles;
+
+    //Memoized results of ExecutableFile::getInfo, indexed by module
+    //name and address relative to the image base
+    ModuleToDebugInfo m_debugInfo;
+    StringSet m_debugStrings;
+
+    //Persistent version of m_debugInfo, the executable files are only
+    //opened for the addresses that are not in the database.
+    ModuleToSymbolDatabase m_symbolDatabases;
+
+    //Serializes the accesses to the caches,
+    //the processors of a trace may run on several threads.
+    llvm::sys::Mutex m_lock;
+
+    //Serializes the accesses to the executable files, libbfd is not
+    //thread-safe. Must not be acquired while holding m_lock.
+    llvm::sys::Mutex m_bfdLock;
+
+    //Opens the modules that are about to be needed
+    ThreadPool *m_prefetcher;
+
+    struct PrefetchTask;
+
+    DebugInfo getDebugInfo(const std::string &modName, uint64_t reladdr);
+    void onModuleLoad(const s2e::plugins::ExecutionTraceModuleLoad &load);
+    SymbolDatabase *getSymbolDatabase(const std::string &modName);
+    void buildFileIndex();
+    bool findFile(const std::string &fileName, std::string &abspath);
+    void saveSymbolDatabases();
+
 };
 
 }
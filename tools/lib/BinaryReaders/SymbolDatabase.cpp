@@ -0,0 +1,264 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "SymbolDatabase.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include <lib/Utils/TemporaryFile.h>
+
+namespace s2etools
+{
+
+namespace {
+
+struct SymbolDatabaseHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t binarySize;
+    uint64_t binaryTime;
+    uint32_t entryCount;
+    uint32_t stringsSize;
+};
+
+uint32_t addString(std::map<std::string, uint32_t> &offsets, std::string &strings,
+                   const std::string &s)
+{
+    std::map<std::string, uint32_t>::const_iterator it = offsets.find(s);
+    if (it != offsets.end()) {
+        return (*it).second;
+    }
+
+    uint32_t offset = strings.size();
+    strings.append(s.c_str(), s.size() + 1);
+    offsets[s] = offset;
+    return offset;
+}
+
+}
+
+const uint32_t SymbolDatabase::MAGIC;
+const uint32_t SymbolDatabase::VERSION;
+const uint32_t SymbolDatabase::NO_STRING;
+
+SymbolDatabase::SymbolDatabase()
+{
+    m_binarySize = 0;
+    m_binaryTime = 0;
+    m_entries = NULL;
+    m_entryCount = 0;
+    m_strings = NULL;
+    m_stringsSize = 0;
+}
+
+bool SymbolDatabase::open(const std::string &binary)
+{
+    struct stat binaryStat;
+    if (stat(binary.c_str(), &binaryStat) != 0) {
+        return false;
+    }
+
+    m_fileName = getDatabaseFileName(binary);
+    m_binarySize = binaryStat.st_size;
+    m_binaryTime = binaryStat.st_mtime;
+
+    if (llvm::MemoryBuffer::getFile(m_fileName.c_str(), m_buffer)) {
+        return false;
+    }
+
+    SymbolDatabaseHeader hdr;
+    const char *data = m_buffer->getBufferStart();
+    uint64_t size = m_buffer->getBufferSize();
+
+    bool valid = size >= sizeof(hdr);
+    if (valid) {
+        memcpy(&hdr, data, sizeof(hdr));
+        valid = hdr.magic == MAGIC && hdr.version == VERSION &&
+                hdr.binarySize == m_binarySize && hdr.binaryTime == m_binaryTime &&
+                sizeof(hdr) + (uint64_t)hdr.entryCount * sizeof(Entry) + hdr.stringsSize == size;
+    }
+
+    //Strings must be null-terminated
+    if (valid && hdr.stringsSize > 0) {
+        valid = data[size - 1] == 0;
+    }
+
+    if (!valid) {
+        m_buffer.reset();
+        return false;
+    }
+
+    m_entries = (const Entry*)(data + sizeof(hdr));
+    m_entryCount = hdr.entryCount;
+    m_strings = data + sizeof(hdr) + hdr.entryCount * sizeof(Entry);
+    m_stringsSize = hdr.stringsSize;
+    return true;
+}
+
+const char *SymbolDatabase::getString(uint32_t offset) const
+{
+    return offset < m_stringsSize ? m_strings + offset : "";
+}
+
+bool SymbolDatabase::lookup(uint64_t address, bool &found, std::string &file,
+                            uint64_t &line, std::string &function) const
+{
+    AddedEntries::const_iterator it = m_added.find(address);
+    if (it != m_added.end()) {
+        const AddedEntry &e = (*it).second;
+        found = e.found;
+        file = e.file;
+        line = e.line;
+        function = e.function;
+        return true;
+    }
+
+    uint32_t low = 0, high = m_entryCount;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (m_entries[mid].address < address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == m_entryCount || m_entries[low].address != address) {
+        return false;
+    }
+
+    const Entry &e = m_entries[low];
+    found = e.file != NO_STRING;
+    if (found) {
+        file = getString(e.file);
+        line = e.line;
+        function = getString(e.function);
+    }
+    return true;
+}
+
+void SymbolDatabase::add(uint64_t address, bool found, const std::string &file,
+                         uint64_t line, const std::string &function)
+{
+    AddedEntry &e = m_added[address];
+    e.found = found;
+    e.file = found ? file : "";
+    e.line = found ? line : 0;
+    e.function = found ? function : "";
+}
+
+bool SymbolDatabase::save()
+{
+    if (m_added.empty() || m_fileName.empty()) {
+        return true;
+    }
+
+    //Merge the new entries with the ones from the file
+    std::vector<Entry> entries;
+    std::map<std::string, uint32_t> offsets;
+    std::string strings;
+
+    entries.reserve(m_entryCount + m_added.size());
+
+    uint32_t i = 0;
+    AddedEntries::const_iterator it = m_added.begin();
+    while (i < m_entryCount || it != m_added.end()) {
+        Entry e;
+        if (it == m_added.end() || (i < m_entryCount && m_entries[i].address < (*it).first)) {
+            const Entry &old = m_entries[i++];
+            e.address = old.address;
+            e.line = old.line;
+            e.file = NO_STRING;
+            e.function = NO_STRING;
+            if (old.file != NO_STRING) {
+                e.file = addString(offsets, strings, getString(old.file));
+                e.function = addString(offsets, strings, getString(old.function));
+            }
+        } else {
+            if (i < m_entryCount && m_entries[i].address == (*it).first) {
+                ++i;
+            }
+            const AddedEntry &added = (*it).second;
+            e.address = (*it).first;
+            e.line = added.line;
+            e.file = NO_STRING;
+            e.function = NO_STRING;
+            if (added.found) {
+                e.file = addString(offsets, strings, added.file);
+                e.function = addString(offsets, strings, added.function);
+            }
+            ++it;
+        }
+        entries.push_back(e);
+    }
+
+    SymbolDatabaseHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MAGIC;
+    hdr.version = VERSION;
+    hdr.binarySize = m_binarySize;
+    hdr.binaryTime = m_binaryTime;
+    hdr.entryCount = entries.size();
+    hdr.stringsSize = strings.size();
+
+    //Other tool runs may be reading the database
+    std::string tmpFile = getTemporaryFileName(m_fileName);
+    FILE *fp = fopen(tmpFile.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    if (ok && !entries.empty()) {
+        ok = fwrite(&entries[0], sizeof(Entry), entries.size(), fp) == entries.size();
+    }
+    if (ok && !strings.empty()) {
+        ok = fwrite(strings.data(), strings.size(), 1, fp) == 1;
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmpFile.c_str(), m_fileName.c_str()) != 0) {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,124 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_SYMBOLDATABASE_H
+#define S2ETOOLS_SYMBOLDATABASE_H
+
+#include <string>
+#include <map>
+#include <inttypes.h>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/ADT/OwningPtr.h>
+
+namespace s2etools
+{
+
+/**
+ *  Debug information of a binary saved next to it (<binary>.symdb), so that
+ *  later tool runs do not have to open the binary with libbfd.
+ *
+ *  The database holds the results of all the lookups done by previous runs,
+ *  sorted by address, and lookups are binary searches over the mapped file.
+ *  It is tied to the binary by its size and modification time, like the
+ *  trace index, so that opening it does not require reading the binary.
+ *  A stale database is ignored and rewritten.
+ */
+class SymbolDatabase
+{
+public:
+    static const uint32_t MAGIC = 0x42445953; //"SYDB"
+    static const uint32_t VERSION = 2;
+    static const uint32_t NO_STRING = 0xffffffff;
+
+    //file and function are offsets in the string table,
+    //file is NO_STRING if the address has no debug information
+    struct Entry {
+        uint64_t address;
+        uint64_t line;
+        uint32_t file;
+        uint32_t function;
+    };
+
+private:
+    struct AddedEntry {
+        bool found;
+        std::string file, function;
+        uint64_t line;
+    };
+
+    typedef std::map<uint64_t, AddedEntry> AddedEntries;
+
+    std::string m_fileName;
+    uint64_t m_binarySize;
+    uint64_t m_binaryTime;
+
+    llvm::OwningPtr<llvm::MemoryBuffer> m_buffer;
+    const Entry *m_entries;
+    uint32_t m_entryCount;
+    const char *m_strings;
+    uint32_t m_stringsSize;
+
+    //Lookups that were not in the file, written back by save()
+    AddedEntries m_added;
+
+    const char *getString(uint32_t offset) const;
+
+public:
+    SymbolDatabase();
+
+    //Loads the database of the binary. Returns false if there is no
+    //valid database, lookups then fail until entries are added.
+    bool open(const std::string &binary);
+
+    //Returns false if the address is not in the database. Otherwise,
+    //found tells whether the binary has debug information for it.
+    bool lookup(uint64_t address, bool &found, std::string &file,
+                uint64_t &line, std::string &function) const;
+
+    void add(uint64_t address, bool found, const std::string &file,
+             uint64_t line, const std::string &function);
+
+    //Writes the database if entries were added since it was opened
+    bool save();
+
+    static std::string getDatabaseFileName(const std::string &binary) {
+        return binary + ".symdb";
+    }
+};
+
+}
+
+#endif
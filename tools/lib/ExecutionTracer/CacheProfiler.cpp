@@ -45,23 +45,18 @@ namespace s2etools {
 CacheProfiler::CacheProfiler(LogEvents *events)
 {
    m_events = events;
-   m_connection = events->onEachItem.connect(
-           sigc::mem_fun(*this, &CacheProfiler::onItem));
+   events->subscribe<CacheProfiler, &CacheProfiler::onItem>(s2e::plugins::TRACE_CACHESIM, this);
 }
 
 CacheProfiler::~CacheProfiler()
 {
-    m_connection.disconnect();
+    m_events->unsubscribe(this);
 }
 
 void CacheProfiler::onItem(unsigned traceIndex,
         const s2e::plugins::ExecutionTraceItemHeader &hdr,
         void *item)
 {
-    if (hdr.type != s2e::plugins::TRACE_CACHESIM) {
-        return;
-    }
-
     ExecutionTraceCache *cacheItem = (ExecutionTraceCache*)item;
 
     switch(cacheItem->type) {
@@ -69,6 +64,7 @@ void CacheProfiler::onItem(unsigned traceIndex,
         //Save the name of the cache and the associated id.
         //Actual parameters will come later in the trace
         case s2e::plugins::CACHE_NAME: {
+            llvm::sys::ScopedLock lock(m_lock);
             std::string s((const char*)cacheItem->name.name, cacheItem->name.length);
             m_cacheIds[cacheItem->name.id] = s;
         }
@@ -77,6 +73,7 @@ void CacheProfiler::onItem(unsigned traceIndex,
         //Create the cache according to the parameters
         //in the trace
         case s2e::plugins::CACHE_PARAMS: {
+            llvm::sys::ScopedLock lock(m_lock);
             CacheIdToName::iterator it = m_cacheIds.find(cacheItem->params.cacheId);
             assert(it != m_cacheIds.end());
 
@@ -131,10 +128,13 @@ void CacheProfilerState::processCacheItem(CacheProfiler *cp,
                       const s2e::plugins::ExecutionTraceItemHeader &hdr,
                       const s2e::plugins::ExecutionTraceCacheSimEntry &e)
 {
-    CacheProfiler::Caches::iterator it = cp->m_caches.find(e.cacheId);
-    assert(it != cp->m_caches.end());
-
-    Cache *c = (*it).second;
+    Cache *c;
+    {
+        llvm::sys::ScopedLock lock(cp->m_lock);
+        CacheProfiler::Caches::iterator it = cp->m_caches.find(e.cacheId);
+        assert(it != cp->m_caches.end());
+        c = (*it).second;
+    }
     assert(c);
 
     CacheStatistics addend(e.isWrite ? 0 : e.missCount,
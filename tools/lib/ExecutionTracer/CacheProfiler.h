@@ -38,6 +38,8 @@
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
 #include "LogParser.h"
 
+#include "llvm/Support/Mutex.h"
+
 namespace s2etools {
 
 class Cache;
@@ -50,12 +52,14 @@ public:
     typedef std::map<uint32_t, std::string> CacheIdToName;
 
 private:
-    sigc::connection m_connection;
     LogEvents *m_events;
 
     Caches m_caches;
     CacheIdToName m_cacheIds;
 
+    //Protects m_caches and m_cacheIds
+    llvm::sys::Mutex m_lock;
+
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
                 void *item);
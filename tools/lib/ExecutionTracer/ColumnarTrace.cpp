@@ -0,0 +1,784 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <cassert>
+#include <iostream>
+#include "ColumnarTrace.h"
+
+using namespace s2e::plugins;
+
+namespace s2etools
+{
+
+namespace {
+
+struct ColumnFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+//The module file has the same header, followed by the rows
+const uint32_t MODULE_MAGIC = 0x574f5253; //"SROW"
+const uint32_t MODULE_VERSION = 1;
+
+#define HEADER_FIELD(name, field) \
+    { name, true, offsetof(ExecutionTraceItemHeader, field), sizeof(((ExecutionTraceItemHeader*)0)->field) }
+
+#define PAYLOAD_FIELD(name, type, field) \
+    { name, false, offsetof(type, field), sizeof(((type*)0)->field) }
+
+#define TB_REGISTER(name, i) \
+    { name, false, offsetof(ExecutionTraceTb, registers) + (i) * sizeof(uint64_t), sizeof(uint64_t) }
+
+const ColumnField s_tbFields[] = {
+    HEADER_FIELD("timestamp", timeStamp),
+    HEADER_FIELD("state", stateId),
+    HEADER_FIELD("pid", pid),
+    PAYLOAD_FIELD("pc", ExecutionTraceTb, pc),
+    PAYLOAD_FIELD("targetpc", ExecutionTraceTb, targetPc),
+    PAYLOAD_FIELD("size", ExecutionTraceTb, size),
+    PAYLOAD_FIELD("tbtype", ExecutionTraceTb, tbType),
+    PAYLOAD_FIELD("symbmask", ExecutionTraceTb, symbMask),
+    TB_REGISTER("reg0", 0), TB_REGISTER("reg1", 1),
+    TB_REGISTER("reg2", 2), TB_REGISTER("reg3", 3),
+    TB_REGISTER("reg4", 4), TB_REGISTER("reg5", 5),
+    TB_REGISTER("reg6", 6), TB_REGISTER("reg7", 7)
+};
+
+const ColumnField s_memoryFields[] = {
+    HEADER_FIELD("timestamp", timeStamp),
+    HEADER_FIELD("state", stateId),
+    HEADER_FIELD("pid", pid),
+    PAYLOAD_FIELD("pc", ExecutionTraceMemory, pc),
+    PAYLOAD_FIELD("address", ExecutionTraceMemory, address),
+    PAYLOAD_FIELD("value", ExecutionTraceMemory, value),
+    PAYLOAD_FIELD("size", ExecutionTraceMemory, size),
+    PAYLOAD_FIELD("flags", ExecutionTraceMemory, flags),
+    PAYLOAD_FIELD("hostaddress", ExecutionTraceMemory, hostAddress),
+    PAYLOAD_FIELD("concretebuffer", ExecutionTraceMemory, concreteBuffer)
+};
+
+struct ColumnarType {
+    unsigned type;
+    const char *name;
+    const ColumnField *fields;
+    unsigned fieldCount;
+    unsigned payloadSize;
+};
+
+const ColumnarType s_types[] = {
+    { TRACE_TB_START, "tb_start", s_tbFields,
+      sizeof(s_tbFields) / sizeof(s_tbFields[0]), sizeof(ExecutionTraceTb) },
+    { TRACE_MEMORY, "memory", s_memoryFields,
+      sizeof(s_memoryFields) / sizeof(s_memoryFields[0]), sizeof(ExecutionTraceMemory) }
+};
+
+const unsigned s_typeCount = sizeof(s_types) / sizeof(s_types[0]);
+
+const ColumnarType *getType(unsigned type)
+{
+    for (unsigned i = 0; i < s_typeCount; ++i) {
+        if (s_types[i].type == type) {
+            return &s_types[i];
+        }
+    }
+    return NULL;
+}
+
+uint64_t getField(const ColumnField &f, const ExecutionTraceItemHeader &hdr, const uint8_t *payload)
+{
+    const uint8_t *src = f.inHeader ? (const uint8_t*)&hdr : payload;
+    uint64_t value = 0;
+    memcpy(&value, src + f.offset, f.width);
+    return value;
+}
+
+void setField(const ColumnField &f, ExecutionTraceItemHeader &hdr, uint8_t *payload, uint64_t value)
+{
+    uint8_t *dst = f.inHeader ? (uint8_t*)&hdr : payload;
+    memcpy(dst + f.offset, &value, f.width);
+}
+
+//Columns of one type, decoded in trace order by replay()
+struct ReplayColumns {
+    const ColumnarType *type;
+    ColumnReader index;
+    std::vector<ColumnReader*> fields;
+
+    //Trace index of the next item, if any
+    uint64_t next;
+    bool hasNext;
+
+    ~ReplayColumns() {
+        for (unsigned i = 0; i < fields.size(); ++i) {
+            delete fields[i];
+        }
+    }
+};
+
+//Module items, read in trace order by replay(). Each row holds the
+//index of the item, its header and its payload.
+struct ModuleRows {
+    FILE *fp;
+    uint64_t count;
+    uint64_t read;
+
+    uint64_t next;
+    bool hasNext;
+    ExecutionTraceItemHeader hdr;
+
+    //The size of the payload is stored in 8 bits
+    uint8_t payload[256];
+
+    ModuleRows() {
+        fp = NULL;
+        count = read = 0;
+        hasNext = false;
+    }
+
+    ~ModuleRows() {
+        if (fp) {
+            fclose(fp);
+        }
+    }
+
+    bool open(const std::string &fileName);
+    bool advance();
+    bool atEnd();
+};
+
+bool ModuleRows::open(const std::string &fileName)
+{
+    struct stat fileStat;
+    if (stat(fileName.c_str(), &fileStat) != 0) {
+        return false;
+    }
+
+    fp = fopen(fileName.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    ColumnFileHeader fileHdr;
+    if (fread(&fileHdr, sizeof(fileHdr), 1, fp) != 1 ||
+        fileHdr.magic != MODULE_MAGIC || fileHdr.version != MODULE_VERSION) {
+        return false;
+    }
+
+    uint64_t dataSize = (uint64_t)fileStat.st_size - sizeof(fileHdr);
+    if (fileHdr.count > dataSize / (sizeof(next) + sizeof(hdr))) {
+        return false;
+    }
+
+    count = fileHdr.count;
+    return advance();
+}
+
+//Reads the next row. Fails if the file is corrupted.
+bool ModuleRows::advance()
+{
+    hasNext = false;
+    if (read == count) {
+        return true;
+    }
+
+    if (fread(&next, sizeof(next), 1, fp) != 1 ||
+        fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        !ColumnarTrace::isModuleType(hdr.type) ||
+        hdr.size > sizeof(payload) ||
+        (hdr.size && fread(payload, hdr.size, 1, fp) != 1)) {
+        return false;
+    }
+
+    ++read;
+    hasNext = true;
+    return true;
+}
+
+bool ModuleRows::atEnd()
+{
+    return fp && read == count && fgetc(fp) == EOF && !ferror(fp);
+}
+
+const size_t COLUMN_BUFFER_SIZE = 64 * 1024;
+
+}
+
+const uint32_t ColumnWriter::MAGIC;
+const uint32_t ColumnWriter::VERSION;
+
+ColumnWriter::ColumnWriter()
+{
+    m_fp = NULL;
+    m_previous = 0;
+    m_count = 0;
+}
+
+ColumnWriter::~ColumnWriter()
+{
+    if (m_fp) {
+        fclose(m_fp);
+    }
+}
+
+bool ColumnWriter::open(const std::string &fileName)
+{
+    assert(!m_fp);
+    m_fp = fopen(fileName.c_str(), "wb");
+    if (!m_fp) {
+        return false;
+    }
+
+    //The count is filled in by close()
+    ColumnFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    return fwrite(&hdr, sizeof(hdr), 1, m_fp) == 1;
+}
+
+bool ColumnWriter::flush()
+{
+    if (m_buffer.empty()) {
+        return true;
+    }
+
+    bool ok = fwrite(&m_buffer[0], m_buffer.size(), 1, m_fp) == 1;
+    m_buffer.clear();
+    return ok;
+}
+
+bool ColumnWriter::append(uint64_t value)
+{
+    int64_t delta = (int64_t)(value - m_previous);
+    uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    m_previous = value;
+    ++m_count;
+
+    while (zigzag >= 0x80) {
+        m_buffer.push_back((uint8_t)(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    m_buffer.push_back((uint8_t)zigzag);
+
+    if (m_buffer.size() >= COLUMN_BUFFER_SIZE) {
+        return flush();
+    }
+    return true;
+}
+
+bool ColumnWriter::close()
+{
+    assert(m_fp);
+
+    bool ok = flush();
+
+    ColumnFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MAGIC;
+    hdr.version = VERSION;
+    hdr.count = m_count;
+
+    ok = ok && fseek(m_fp, 0, SEEK_SET) == 0 &&
+         fwrite(&hdr, sizeof(hdr), 1, m_fp) == 1;
+
+    ok = (fclose(m_fp) == 0) && ok;
+    m_fp = NULL;
+    return ok;
+}
+
+ColumnReader::ColumnReader()
+{
+    m_fp = NULL;
+    m_previous = 0;
+    m_count = 0;
+    m_read = 0;
+    m_position = 0;
+}
+
+ColumnReader::~ColumnReader()
+{
+    if (m_fp) {
+        fclose(m_fp);
+    }
+}
+
+bool ColumnReader::open(const std::string &fileName)
+{
+    assert(!m_fp);
+
+    struct stat fileStat;
+    if (stat(fileName.c_str(), &fileStat) != 0) {
+        return false;
+    }
+
+    m_fp = fopen(fileName.c_str(), "rb");
+    if (!m_fp) {
+        return false;
+    }
+
+    ColumnFileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, m_fp) != 1 ||
+        hdr.magic != ColumnWriter::MAGIC || hdr.version != ColumnWriter::VERSION) {
+        return false;
+    }
+
+    //Every value takes at least one byte
+    uint64_t dataSize = (uint64_t)fileStat.st_size - sizeof(hdr);
+    if (hdr.count > dataSize) {
+        return false;
+    }
+
+    m_count = hdr.count;
+    return true;
+}
+
+bool ColumnReader::fill()
+{
+    m_buffer.resize(COLUMN_BUFFER_SIZE);
+    m_buffer.resize(fread(&m_buffer[0], 1, m_buffer.size(), m_fp));
+    m_position = 0;
+    return !m_buffer.empty();
+}
+
+bool ColumnReader::next(uint64_t &value)
+{
+    if (!m_fp || m_read >= m_count) {
+        return false;
+    }
+
+    uint64_t zigzag = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+        if (shift > 63 || (m_position == m_buffer.size() && !fill())) {
+            return false;
+        }
+        byte = m_buffer[m_position++];
+        zigzag |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    m_previous += (uint64_t)delta;
+    ++m_read;
+
+    value = m_previous;
+    return true;
+}
+
+bool ColumnReader::atEnd()
+{
+    return m_fp && m_read == m_count && m_position == m_buffer.size() &&
+           !fill() && !ferror(m_fp);
+}
+
+bool readColumn(const std::string &fileName, std::vector<uint64_t> &values)
+{
+    values.clear();
+
+    ColumnReader reader;
+    if (!reader.open(fileName)) {
+        return false;
+    }
+
+    //The count is bounded by the size of the file
+    values.reserve(reader.getCount());
+
+    uint64_t value;
+    while (reader.next(value)) {
+        values.push_back(value);
+    }
+
+    if (values.size() != reader.getCount() || !reader.atEnd()) {
+        values.clear();
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+ColumnarTraceWriter::ColumnarTraceWriter(LogEvents *events)
+{
+    m_events = events;
+    m_modules = NULL;
+    m_moduleCount = 0;
+    m_ok = true;
+    memset(m_types, 0, sizeof(m_types));
+}
+
+ColumnarTraceWriter::~ColumnarTraceWriter()
+{
+    m_events->unsubscribe(this);
+
+    for (unsigned i = 0; i < TRACE_MAX; ++i) {
+        TypeColumns *tc = m_types[i];
+        if (!tc) {
+            continue;
+        }
+        for (unsigned j = 0; j < tc->columns.size(); ++j) {
+            delete tc->columns[j];
+        }
+        delete tc;
+    }
+
+    if (m_modules) {
+        fclose(m_modules);
+    }
+}
+
+bool ColumnarTraceWriter::open(const std::string &directory)
+{
+    for (unsigned i = 0; i < s_typeCount; ++i) {
+        const ColumnarType &t = s_types[i];
+        TypeColumns *tc = new TypeColumns();
+        tc->fields = t.fields;
+        tc->fieldCount = t.fieldCount;
+        tc->payloadSize = t.payloadSize;
+        m_types[t.type] = tc;
+
+        std::string fileName = ColumnarTrace::getColumnFileName(directory, t.type, "index");
+        if (!tc->index.open(fileName)) {
+            std::cerr << "Could not open " << fileName << std::endl;
+            return false;
+        }
+
+        for (unsigned j = 0; j < t.fieldCount; ++j) {
+            fileName = ColumnarTrace::getColumnFileName(directory, t.type, t.fields[j].name);
+            tc->columns.push_back(new ColumnWriter());
+            if (!tc->columns.back()->open(fileName)) {
+                std::cerr << "Could not open " << fileName << std::endl;
+                return false;
+            }
+        }
+
+        m_events->subscribe<ColumnarTraceWriter, &ColumnarTraceWriter::onItem>(t.type, this);
+    }
+
+    //The count is filled in by close()
+    std::string fileName = ColumnarTrace::getModuleFileName(directory);
+    ColumnFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    m_modules = fopen(fileName.c_str(), "wb");
+    if (!m_modules || fwrite(&hdr, sizeof(hdr), 1, m_modules) != 1) {
+        std::cerr << "Could not open " << fileName << std::endl;
+        return false;
+    }
+
+    for (unsigned type = 0; type < TRACE_MAX; ++type) {
+        if (ColumnarTrace::isModuleType(type)) {
+            m_events->subscribe<ColumnarTraceWriter, &ColumnarTraceWriter::onModuleItem>(type, this);
+        }
+    }
+
+    return true;
+}
+
+void ColumnarTraceWriter::onItem(unsigned traceIndex,
+                                 const ExecutionTraceItemHeader &hdr,
+                                 void *item)
+{
+    TypeColumns *tc = m_types[hdr.type];
+    assert(tc);
+
+    //Older traces may have shorter payloads
+    uint8_t payload[sizeof(ExecutionTraceTb) + sizeof(ExecutionTraceMemory)];
+    assert(tc->payloadSize <= sizeof(payload));
+    memset(payload, 0, tc->payloadSize);
+    memcpy(payload, item, hdr.size < tc->payloadSize ? hdr.size : tc->payloadSize);
+
+    m_ok = tc->index.append(traceIndex) && m_ok;
+    for (unsigned i = 0; i < tc->fieldCount; ++i) {
+        m_ok = tc->columns[i]->append(getField(tc->fields[i], hdr, payload)) && m_ok;
+    }
+}
+
+void ColumnarTraceWriter::onModuleItem(unsigned traceIndex,
+                                       const ExecutionTraceItemHeader &hdr,
+                                       void *item)
+{
+    uint64_t index = traceIndex;
+    m_ok = fwrite(&index, sizeof(index), 1, m_modules) == 1 &&
+           fwrite(&hdr, sizeof(hdr), 1, m_modules) == 1 &&
+           (!hdr.size || fwrite(item, hdr.size, 1, m_modules) == 1) && m_ok;
+    ++m_moduleCount;
+}
+
+bool ColumnarTraceWriter::close()
+{
+    m_events->unsubscribe(this);
+
+    bool ok = m_ok;
+    for (unsigned i = 0; i < TRACE_MAX; ++i) {
+        TypeColumns *tc = m_types[i];
+        if (!tc) {
+            continue;
+        }
+        ok = tc->index.close() && ok;
+        for (unsigned j = 0; j < tc->columns.size(); ++j) {
+            ok = tc->columns[j]->close() && ok;
+        }
+    }
+
+    if (m_modules) {
+        ColumnFileHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = MODULE_MAGIC;
+        hdr.version = MODULE_VERSION;
+        hdr.count = m_moduleCount;
+
+        ok = ok && fseek(m_modules, 0, SEEK_SET) == 0 &&
+             fwrite(&hdr, sizeof(hdr), 1, m_modules) == 1;
+        ok = (fclose(m_modules) == 0) && ok;
+        m_modules = NULL;
+    }
+    return ok;
+}
+
+uint64_t ColumnarTraceWriter::getItemCount(unsigned type) const
+{
+    if (type >= TRACE_MAX || !m_types[type]) {
+        return 0;
+    }
+    return m_types[type]->index.getCount();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+ColumnarTrace::ColumnarTrace(const std::string &directory)
+{
+    m_directory = directory;
+}
+
+ColumnarTrace::~ColumnarTrace()
+{
+    ItemProcessors::iterator it;
+    for (it = m_ItemProcessors.begin(); it != m_ItemProcessors.end(); ++it) {
+        (*it).second->decref();
+    }
+}
+
+bool ColumnarTrace::isSupported(unsigned type)
+{
+    return getType(type) != NULL;
+}
+
+bool ColumnarTrace::isModuleType(unsigned type)
+{
+    return type == TRACE_MOD_LOAD || type == TRACE_MOD_UNLOAD ||
+           type == TRACE_PROC_UNLOAD;
+}
+
+const ColumnField *ColumnarTrace::getFields(unsigned type, unsigned &count)
+{
+    const ColumnarType *t = getType(type);
+    count = t ? t->fieldCount : 0;
+    return t ? t->fields : NULL;
+}
+
+std::string ColumnarTrace::getColumnFileName(const std::string &directory,
+                                             unsigned type, const std::string &field)
+{
+    const ColumnarType *t = getType(type);
+    assert(t);
+    return directory + "/" + t->name + "." + field + ".col";
+}
+
+std::string ColumnarTrace::getModuleFileName(const std::string &directory)
+{
+    return directory + "/modules.rows";
+}
+
+bool ColumnarTrace::getColumn(unsigned type, const std::string &field,
+                              std::vector<uint64_t> &values) const
+{
+    if (!isSupported(type)) {
+        return false;
+    }
+    return readColumn(getColumnFileName(m_directory, type, field), values);
+}
+
+bool ColumnarTrace::replay()
+{
+    std::vector<ReplayColumns*> types;
+    bool ok = true;
+
+    for (unsigned i = 0; ok && i < s_typeCount; ++i) {
+        const ColumnarType &t = s_types[i];
+        if (!hasItemHandlers(t.type)) {
+            continue;
+        }
+
+        ReplayColumns *rc = new ReplayColumns();
+        types.push_back(rc);
+        rc->type = &t;
+
+        ok = rc->index.open(getColumnFileName(m_directory, t.type, "index"));
+        for (unsigned j = 0; ok && j < t.fieldCount; ++j) {
+            rc->fields.push_back(new ColumnReader());
+            ok = rc->fields[j]->open(getColumnFileName(m_directory, t.type, t.fields[j].name)) &&
+                 rc->fields[j]->getCount() == rc->index.getCount();
+        }
+
+        rc->hasNext = ok && rc->index.next(rc->next);
+
+        if (!ok) {
+            std::cerr << "ColumnarTrace: Could not read the " << t.name << " columns in "
+                      << m_directory << std::endl;
+        }
+    }
+
+    ModuleRows modules;
+    bool replayModules = hasItemHandlers(TRACE_MOD_LOAD) ||
+                         hasItemHandlers(TRACE_MOD_UNLOAD) ||
+                         hasItemHandlers(TRACE_PROC_UNLOAD);
+
+    if (ok && replayModules) {
+        ok = modules.open(getModuleFileName(m_directory));
+        if (!ok) {
+            std::cerr << "ColumnarTrace: Could not read the module items in "
+                      << m_directory << std::endl;
+        }
+    }
+
+    uint8_t payload[sizeof(ExecutionTraceTb) + sizeof(ExecutionTraceMemory)];
+
+    //Merge the types back in trace order
+    while (ok) {
+        ReplayColumns *next = NULL;
+        for (unsigned i = 0; i < types.size(); ++i) {
+            ReplayColumns *rc = types[i];
+            if (rc->hasNext && (!next || rc->next < next->next)) {
+                next = rc;
+            }
+        }
+
+        //Modules are loaded before the items that run in them
+        if (modules.hasNext && (!next || modules.next < next->next)) {
+            processItem(modules.next, modules.hdr, modules.payload);
+            if (!modules.advance()) {
+                break;
+            }
+            continue;
+        }
+
+        if (!next) {
+            break;
+        }
+
+        const ColumnarType *t = next->type;
+        ExecutionTraceItemHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memset(payload, 0, t->payloadSize);
+        hdr.type = t->type;
+        hdr.size = t->payloadSize;
+
+        for (unsigned i = 0; ok && i < t->fieldCount; ++i) {
+            uint64_t value;
+            ok = next->fields[i]->next(value);
+            if (ok) {
+                setField(t->fields[i], hdr, payload, value);
+            }
+        }
+
+        if (!ok) {
+            break;
+        }
+
+        unsigned index = next->next;
+        next->hasNext = next->index.next(next->next);
+        processItem(index, hdr, payload);
+    }
+
+    if (ok && replayModules && !modules.atEnd()) {
+        std::cerr << "ColumnarTrace: The module items in " << m_directory
+                  << " are corrupted" << std::endl;
+        ok = false;
+    }
+
+    //All the columns of a type must end together
+    for (unsigned i = 0; i < types.size(); ++i) {
+        ReplayColumns *rc = types[i];
+        bool complete = rc->index.atEnd();
+        for (unsigned j = 0; complete && j < rc->fields.size(); ++j) {
+            complete = rc->fields[j]->atEnd();
+        }
+
+        if (ok && !complete) {
+            std::cerr << "ColumnarTrace: The " << rc->type->name << " columns in "
+                      << m_directory << " are corrupted" << std::endl;
+            ok = false;
+        }
+        delete rc;
+    }
+
+    return ok;
+}
+
+ItemProcessorState* ColumnarTrace::getState(void *processor, ItemProcessorStateFactory f)
+{
+    ItemProcessors::const_iterator it = m_ItemProcessors.find(processor);
+    if (it != m_ItemProcessors.end()) {
+        return (*it).second;
+    }
+
+    ItemProcessorState *ret = f();
+    m_ItemProcessors[processor] = ret;
+    return ret;
+}
+
+ItemProcessorState* ColumnarTrace::getState(void *processor, uint32_t pathId)
+{
+    assert(pathId == 0);
+    ItemProcessors::const_iterator it = m_ItemProcessors.find(processor);
+    return it == m_ItemProcessors.end() ? NULL : (*it).second;
+}
+
+//Like LogParser, the exported trace is a single path
+void ColumnarTrace::getPaths(PathSet &s)
+{
+    s.clear();
+    s.insert(0);
+}
+
+}
@@ -0,0 +1,229 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_EXECTRACER_COLUMNARTRACE_H
+#define S2ETOOLS_EXECTRACER_COLUMNARTRACE_H
+
+#include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "LogParser.h"
+
+namespace s2etools
+{
+
+/**
+ *  Column of 64-bit values stored in its own file. Each value is encoded
+ *  as the zigzag varint of its difference with the previous value, so
+ *  slowly varying fields (timestamps, program counters, flags) take one
+ *  or two bytes per item.
+ */
+class ColumnWriter
+{
+private:
+    FILE *m_fp;
+    uint64_t m_previous;
+    uint64_t m_count;
+    std::vector<uint8_t> m_buffer;
+
+    bool flush();
+
+public:
+    static const uint32_t MAGIC = 0x4c4f4353; //"SCOL"
+    static const uint32_t VERSION = 1;
+
+    ColumnWriter();
+    ~ColumnWriter();
+
+    bool open(const std::string &fileName);
+    bool append(uint64_t value);
+    bool close();
+
+    uint64_t getCount() const {
+        return m_count;
+    }
+};
+
+/**
+ *  Decodes a column file written by ColumnWriter one value at a time,
+ *  reading the file through a fixed-size buffer.
+ */
+class ColumnReader
+{
+private:
+    FILE *m_fp;
+    uint64_t m_previous;
+    uint64_t m_count;
+    uint64_t m_read;
+    std::vector<uint8_t> m_buffer;
+    size_t m_position;
+
+    bool fill();
+
+public:
+    ColumnReader();
+    ~ColumnReader();
+
+    //Checks the header. Fails if the file is too short to hold
+    //the number of values that the header announces.
+    bool open(const std::string &fileName);
+
+    //Fails after the last value or if the column is corrupted
+    bool next(uint64_t &value);
+
+    //Whether all the values were read and nothing follows them
+    bool atEnd();
+
+    uint64_t getCount() const {
+        return m_count;
+    }
+};
+
+//Decodes a whole column file written by ColumnWriter
+bool readColumn(const std::string &fileName, std::vector<uint64_t> &values);
+
+/**
+ *  Field of a trace item that is exported as a column,
+ *  either from the item header or from its payload.
+ */
+struct ColumnField {
+    const char *name;
+    bool inHeader;
+    unsigned offset;
+    unsigned width;
+};
+
+/**
+ *  Exports items of the given types from a LogEvents source to
+ *  struct-of-arrays files in a directory, one file per field
+ *  (see ColumnarTrace::getColumnFileName). Every exported type also gets
+ *  an "index" column with the position of the item in the trace.
+ *
+ *  The module load and unload items are rare and have variable-length
+ *  payloads. They are copied as they are, with their index, to a single
+ *  row file (see ColumnarTrace::getModuleFileName).
+ */
+class ColumnarTraceWriter
+{
+private:
+    struct TypeColumns {
+        const ColumnField *fields;
+        unsigned fieldCount;
+        unsigned payloadSize;
+        ColumnWriter index;
+        std::vector<ColumnWriter*> columns;
+    };
+
+    LogEvents *m_events;
+    TypeColumns *m_types[s2e::plugins::TRACE_MAX];
+    FILE *m_modules;
+    uint64_t m_moduleCount;
+    bool m_ok;
+
+    void onItem(unsigned traceIndex,
+                const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                void *item);
+
+    void onModuleItem(unsigned traceIndex,
+                      const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                      void *item);
+
+public:
+    ColumnarTraceWriter(LogEvents *events);
+    ~ColumnarTraceWriter();
+
+    //Creates the column files of all the supported types in the directory
+    bool open(const std::string &directory);
+    bool close();
+
+    uint64_t getItemCount(unsigned type) const;
+
+    uint64_t getModuleItemCount() const {
+        return m_moduleCount;
+    }
+};
+
+/**
+ *  Reads a trace exported by ColumnarTraceWriter.
+ *
+ *  Analyses that only need a few fields should load them with getColumn()
+ *  and scan the resulting arrays. replay() feeds the exported items to
+ *  processors like LogParser::parse() does, in trace order.
+ *  Like LogParser, the trace is seen as a single path.
+ */
+class ColumnarTrace: public LogEvents
+{
+private:
+    std::string m_directory;
+    ItemProcessors m_ItemProcessors;
+
+public:
+    ColumnarTrace(const std::string &directory);
+    virtual ~ColumnarTrace();
+
+    //Whether the trace type is exported as columns (TRACE_TB_START, TRACE_MEMORY)
+    static bool isSupported(unsigned type);
+
+    //Whether the trace type is kept in the module file
+    static bool isModuleType(unsigned type);
+
+    //Returns the fields of the type, NULL if it is not exported
+    static const ColumnField *getFields(unsigned type, unsigned &count);
+
+    static std::string getColumnFileName(const std::string &directory,
+                                         unsigned type, const std::string &field);
+
+    static std::string getModuleFileName(const std::string &directory);
+
+    //Loads one column, field is a name from getFields() or "index"
+    bool getColumn(unsigned type, const std::string &field,
+                   std::vector<uint64_t> &values) const;
+
+    //Passes the items of the types that have handlers to the processors,
+    //including the module items, so that processors that look up modules
+    //(e.g., through ModuleCache) work as on the original trace.
+    //The columns are decoded as the items are replayed.
+    bool replay();
+
+    virtual ItemProcessorState* getState(void *processor, ItemProcessorStateFactory f);
+    virtual ItemProcessorState* getState(void *processor, uint32_t pathId);
+    virtual void getPaths(PathSet &s);
+};
+
+}
+
+#endif
@@ -45,23 +45,18 @@ namespace s2etools {
 InstructionCounter::InstructionCounter(LogEvents *events)
 {
    m_events = events;
-   m_connection = events->onEachItem.connect(
-           sigc::mem_fun(*this, &InstructionCounter::onItem));
+   events->subscribe<InstructionCounter, &InstructionCounter::onItem>(s2e::plugins::TRACE_ICOUNT, this);
 }
 
 InstructionCounter::~InstructionCounter()
 {
-    m_connection.disconnect();
+    m_events->unsubscribe(this);
 }
 
 void InstructionCounter::onItem(unsigned traceIndex,
         const s2e::plugins::ExecutionTraceItemHeader &hdr,
         void *item)
 {
-    if (hdr.type != s2e::plugins::TRACE_ICOUNT) {
-        return;
-    }
-
     ExecutionTraceICount *e = static_cast<ExecutionTraceICount*>(item);
     InstructionCounterState *state = static_cast<InstructionCounterState*>(m_events->getState(this, &InstructionCounterState::factory));
 
@@ -44,7 +44,6 @@ namespace s2etools {
 class InstructionCounter
 {
 private:
-    sigc::connection m_connection;
     LogEvents *m_events;
 
     void onItem(unsigned traceIndex,
@@ -35,7 +35,15 @@
 
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <string.h>
 #include "LogParser.h"
+#include "TraceIndex.h"
+#include "TraceContainer.h"
+
+#include <lib/Utils/ThreadPool.h>
+
+#include "llvm/Support/CommandLine.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -44,6 +52,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/mman.h>
 
 
@@ -52,6 +61,24 @@
 
 //#define DEBUG_LP
 
+namespace {
+    llvm::cl::opt<unsigned>
+            CheckpointInterval("checkpointInterval",
+                               llvm::cl::desc("Keep one random-access checkpoint every N trace items. "
+                                              "0 streams the trace in a single pass without random access."),
+                               llvm::cl::init(s2etools::LogParser::DEFAULT_CHECKPOINT_INTERVAL));
+
+    llvm::cl::opt<bool>
+            UseTraceIndex("traceIndex",
+                          llvm::cl::desc("Cache the layout of each trace in a <trace>.idx file and reuse it on later runs"),
+                          llvm::cl::init(true));
+
+    llvm::cl::opt<unsigned>
+            BlockCacheSize("blockCache",
+                           llvm::cl::desc("Number of decompressed blocks of compressed traces kept in memory"),
+                           llvm::cl::init(16));
+}
+
 using namespace s2e::plugins;
 
 namespace s2etools
@@ -68,12 +95,35 @@ void LogEvents::processItem(unsigned currentItem,
             " type=" << (int) hdr.type << std::endl;
 #endif
 
-    onEachItem.emit(currentItem, hdr, (void*)data);
+    const Subscriptions &handlers = m_handlers[hdr.type];
+    for (unsigned i = 0; i < handlers.size(); ++i) {
+        handlers[i].handler(handlers[i].processor, currentItem, hdr, data);
+    }
+
+    if (!onEachItem.empty()) {
+        onEachItem.emit(currentItem, hdr, (void*)data);
+    }
 }
 
-LogEvents::LogEvents()
+void LogEvents::unsubscribe(void *processor)
 {
+    for (unsigned type = 0; type < TRACE_MAX; ++type) {
+        Subscriptions &handlers = m_handlers[type];
+        Subscriptions::iterator it = handlers.begin();
+        while (it != handlers.end()) {
+            if ((*it).processor == processor) {
+                it = handlers.erase(it);
+                --m_handlerCount;
+            } else {
+                ++it;
+            }
+        }
+    }
+}
 
+LogEvents::LogEvents()
+{
+    m_handlerCount = 0;
 }
 
 LogEvents::~LogEvents()
@@ -85,47 +135,173 @@ LogEvents::~LogEvents()
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
+//Decompressed block of a compressed file. It is owned by the block cache
+//and by the cursors that point into it, and freed with the last reference.
+struct LogParser::DecodedBlock {
+    unsigned file;
+    unsigned block;
+    uint64_t rawOffset;
+    std::vector<uint8_t> data;
+    volatile llvm::sys::cas_flag refCount;
+};
+
+static void releaseBlock(LogParser::DecodedBlock *block)
+{
+    if (block && llvm::sys::AtomicDecrement(&block->refCount) == 0) {
+        delete block;
+    }
+}
+
+LogParser::ItemCursor::ItemCursor()
+{
+    index = 0;
+    file = 0;
+    address = NULL;
+    block = NULL;
+}
+
+LogParser::ItemCursor::ItemCursor(const ItemCursor &c)
+{
+    index = c.index;
+    file = c.file;
+    address = c.address;
+    block = c.block;
+    if (block) {
+        llvm::sys::AtomicIncrement(&block->refCount);
+    }
+}
+
+LogParser::ItemCursor &LogParser::ItemCursor::operator=(const ItemCursor &c)
+{
+    if (c.block) {
+        llvm::sys::AtomicIncrement(&c.block->refCount);
+    }
+    releaseBlock(block);
+
+    index = c.index;
+    file = c.file;
+    address = c.address;
+    block = c.block;
+    return *this;
+}
+
+LogParser::ItemCursor::~ItemCursor()
+{
+    releaseBlock(block);
+}
+
+void LogParser::ItemCursor::setBlock(DecodedBlock *b)
+{
+    releaseBlock(block);
+    block = b;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+const unsigned LogParser::DEFAULT_CHECKPOINT_INTERVAL;
+
 LogParser::LogParser():LogEvents()
 {
     m_cachedProcessor = NULL;
     m_cachedState = NULL;
+    m_checkpointInterval = CheckpointInterval;
+    m_saveIndex = true;
+    m_itemCount = 0;
+    m_blockCacheSize = BlockCacheSize;
+    m_noRandomAccessReported = 0;
+    memset(m_typeCounts, 0, sizeof(m_typeCounts));
 }
 
 LogParser::~LogParser()
 {
+    DecodedBlocks::iterator bit;
+    for (bit = m_blockCache.begin(); bit != m_blockCache.end(); ++bit) {
+        releaseBlock(*bit);
+    }
 
     LogFiles::iterator it;
     for(it=m_files.begin(); it != m_files.end(); ++it) {
         LogFile &file = *it;
         #ifdef _WIN32
-        UnmapViewOfFile(file.m_File);
-        CloseHandle(file.m_hMapping);
-        CloseHandle(file.m_hFile);
+        if (file.m_hMapping) {
+            UnmapViewOfFile(file.m_File);
+            CloseHandle(file.m_hMapping);
+            CloseHandle(file.m_hFile);
+        }
         #else
         if (file.m_File) {
-            munmap(file.m_File, file.m_size);
+            munmap(file.m_File, file.m_mappedSize);
         }
         #endif
     }
 }
 
 
+//Maps and indexes one file of the trace on a worker thread
+struct LogParser::FileLoader: public ThreadPoolTask
+{
+    LogParser *parser;
+    std::string fileName;
+    LogFile element;
+    TraceIndex index;
+    bool mapped, complete;
+
+    FileLoader(LogParser *p, const std::string &f) {
+        parser = p;
+        fileName = f;
+        mapped = complete = false;
+    }
+
+    void run() {
+        mapped = parser->loadFile(fileName, element, index, false, complete);
+    }
+};
+
 bool LogParser::parse(const std::vector<std::string> fileNames)
 {
     std::vector<std::string>::const_iterator it;
+
+    //Processors connected to the parser must see the items in trace order
+    if (hasItemHandlers() || fileNames.size() < 2) {
+        for (it = fileNames.begin(); it != fileNames.end(); ++it) {
+            if (!parse(*it)) {
+                std::cerr << *it << " is incomplete" << std::endl;
+            }
+        }
+        return true;
+    }
+
+    //Scan the files in parallel, then stitch them together in order
+    std::vector<FileLoader*> loaders;
+    ThreadPool pool;
+
     for (it = fileNames.begin(); it != fileNames.end(); ++it) {
-        if (!parse(*it)) {
-            std::cerr << *it << " is incomplete" << std::endl;
+        loaders.push_back(new FileLoader(this, *it));
+        pool.submit(loaders.back());
+    }
+
+    pool.wait();
+
+    std::vector<FileLoader*>::iterator lit;
+    for (lit = loaders.begin(); lit != loaders.end(); ++lit) {
+        FileLoader *loader = *lit;
+        if (loader->mapped) {
+            addFile(loader->element, loader->index);
+        }
+        if (!loader->mapped || !loader->complete) {
+            std::cerr << loader->fileName << " is incomplete" << std::endl;
         }
+        delete loader;
     }
+
     return true;
 }
 
 
-bool LogParser::parse(const std::string &fileName)
+bool LogParser::mapFile(const std::string &fileName, LogFile &element)
 {
-    LogFile element;
-
 #ifdef _WIN32
     element.m_hFile = CreateFile(fileName.c_str(), GENERIC_READ,
                               FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
@@ -140,6 +316,18 @@ bool LogParser::parse(const std::string &fileName)
         return false;
     }
 
+    //Empty files cannot be mapped
+    if (FileSize.QuadPart == 0) {
+        std::cerr << "LogParser: " << fileName << " is empty" << std::endl;
+        CloseHandle(element.m_hFile);
+        return false;
+    }
+
+    FILETIME FileTime;
+    if (GetFileTime(element.m_hFile, NULL, NULL, &FileTime)) {
+        element.m_time = ((uint64_t)FileTime.dwHighDateTime << 32) | FileTime.dwLowDateTime;
+    }
+
     element.m_hMapping = CreateFileMapping(element.m_hFile, NULL, PAGE_READONLY, FileSize.HighPart, FileSize.LowPart, NULL);
     if (element.m_hMapping == NULL) {
         CloseHandle(element.m_hFile);
@@ -153,6 +341,7 @@ bool LogParser::parse(const std::string &fileName)
         return false;
     }
 
+    element.m_mappedSize = FileSize.QuadPart;
     element.m_size = FileSize.QuadPart;
 
 #else
@@ -165,32 +354,122 @@ bool LogParser::parse(const std::string &fileName)
     off_t fileSize = lseek(file, 0, SEEK_END);
     if (fileSize == (off_t) -1) {
         std::cerr << "Could not get log file size" << std::endl;
+        close(file);
         return false;
     }
 
-    element.m_File = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
-    if (!element.m_File) {
-        std::cerr << "Could not map the log file in memory" << std::endl;
+    //mmap fails on empty files
+    if (fileSize == 0) {
+        std::cerr << "LogParser: " << fileName << " is empty" << std::endl;
         close(file);
         return false;
     }
 
+    struct stat fileStat;
+    if (fstat(file, &fileStat) == 0) {
+        element.m_time = fileStat.st_mtime;
+    }
+
+    void *mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+
+    //The mapping stays valid after the descriptor is closed
+    close(file);
+
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Could not map the log file in memory" << std::endl;
+        return false;
+    }
+
+    element.m_File = mapping;
+
+    element.m_mappedSize = fileSize;
     element.m_size = fileSize;
 
 #endif
 
+    if (TraceContainer::isContainer(element.m_File, element.m_mappedSize)) {
+        return openContainer(fileName, element);
+    }
 
-    uint64_t currentOffset = 0;
-    unsigned currentItem = m_ItemAddresses.size();
+    return true;
+}
+
+//Reads the seek table of a compressed trace. The blocks stay in the
+//mapping and are decompressed when they are accessed.
+bool LogParser::openContainer(const std::string &fileName, LogFile &element)
+{
+    if (element.m_container.open(element.m_File, element.m_mappedSize)) {
+        element.m_compressed = true;
+        element.m_size = element.m_container.getRawSize();
+        return true;
+    }
+
+    std::cerr << "LogParser: " << fileName << " is not a valid compressed trace" << std::endl;
+
+#ifdef _WIN32
+    UnmapViewOfFile(element.m_File);
+    CloseHandle(element.m_hMapping);
+    CloseHandle(element.m_hFile);
+    element.m_hMapping = NULL;
+    element.m_hFile = NULL;
+#else
+    munmap(element.m_File, element.m_mappedSize);
+#endif
+
+    element.m_File = NULL;
+    element.m_mappedSize = 0;
+    element.m_size = 0;
+    return false;
+}
+
+//Computes the index of the file, passing the items to the processors
+//if emitItems is set. Returns false if the file is truncated.
+bool LogParser::scanFile(const std::string &fileName, const LogFile &element,
+                         TraceIndex &index, bool emitItems)
+{
+    unsigned currentItem = m_itemCount;
+    bool complete = true;
+
+    index.reset(element.m_size, element.m_time, m_checkpointInterval);
+
+    if (!element.m_compressed) {
+        complete = scanItems((uint8_t*)element.m_File, element.m_size, 0,
+                             currentItem, index, emitItems);
+    } else {
+        //Blocks hold whole items and can be scanned one after the other
+        const TraceContainer::Blocks &blocks = element.m_container.getBlocks();
+        std::vector<uint8_t> buffer;
+
+        for (unsigned i = 0; i < blocks.size() && complete; ++i) {
+            buffer.resize(blocks[i].rawSize);
+            if (!element.m_container.readBlock(i, &buffer[0])) {
+                std::cerr << "LogParser: Could not decompress block " << i << " of " << fileName << std::endl;
+                complete = false;
+                break;
+            }
 
-    uint8_t *buffer = (uint8_t*)element.m_File;
+            complete = scanItems(&buffer[0], buffer.size(), blocks[i].rawOffset,
+                                 currentItem, index, emitItems);
+        }
+    }
 
-    while(currentOffset < element.m_size) {
+    index.finalize();
+    return complete;
+}
+
+//Indexes the items of a buffer that starts at the given offset of the
+//uncompressed file. Returns false if the last item is truncated.
+bool LogParser::scanItems(uint8_t *buffer, uint64_t size, uint64_t offset, unsigned &currentItem,
+                          TraceIndex &index, bool emitItems)
+{
+    uint64_t currentOffset = 0;
+
+    while(currentOffset < size) {
 
         s2e::plugins::ExecutionTraceItemHeader *hdr =
                 (s2e::plugins::ExecutionTraceItemHeader *)(buffer);
 
-        if (currentOffset + sizeof(s2e::plugins::ExecutionTraceItemHeader) > element.m_size) {
+        if (currentOffset + sizeof(s2e::plugins::ExecutionTraceItemHeader) > size) {
             std::cerr << "LogParser: Could not read header " << std::endl;
             return false;
         }
@@ -198,39 +477,163 @@ bool LogParser::parse(const std::string &fileName)
         buffer += sizeof(*hdr);
 
         if (hdr->size > 0) {
-            if (currentOffset + hdr->size > element.m_size) {
+            if (currentOffset + sizeof(*hdr) + hdr->size > size) {
                 std::cerr << "LogParser: Could not read payload " << std::endl;
                 return false;
             }
         }
 
 #ifdef DEBUG_PB
-        std::cout << fileName <<  " item=" << currentItem << " buffer="   << (void*)buffer <<
-                     " ts=" << hdr->timeStamp <<  " offset=" << currentOffset << std::endl;
+        std::cout << "item=" << currentItem << " buffer="   << (void*)buffer <<
+                     " ts=" << hdr->timeStamp <<  " offset=" << offset + currentOffset << std::endl;
 #endif
-        processItem(currentItem, *hdr, buffer);
-        buffer+=hdr->size;
+        index.addItem(*hdr, offset + currentOffset);
 
-        m_ItemAddresses.push_back(currentOffset + (uint8_t*)element.m_File);
+        if (emitItems) {
+            processItem(currentItem, *hdr, buffer);
+        }
+        buffer+=hdr->size;
 
         currentOffset += sizeof(s2e::plugins::ExecutionTraceItemHeader)  + hdr->size;
 
         ++currentItem;
     }
 
+    return true;
+}
+
+//Appends the items described by the index to the trace
+void LogParser::addFile(const LogFile &element, const TraceIndex &index)
+{
+    uint32_t firstItem = m_itemCount;
+    uint32_t file = m_files.size();
+    ItemCursor cursor;
+
+    const TraceIndex::Checkpoints &cps = index.getCheckpoints();
+    TraceIndex::Checkpoints::const_iterator cit;
+    for (cit = cps.begin(); cit != cps.end(); ++cit) {
+        m_checkpoints.push_back(ItemCheckpoint(firstItem + (*cit).index, file, (*cit).offset));
+    }
+
+    for (unsigned i = 0; i < s2e::plugins::TRACE_MAX; ++i) {
+        m_typeCounts[i] += index.getTypeCount(i);
+    }
+
+    m_itemCount += index.getItemCount();
     m_files.push_back(element);
-    //fclose(file);
+
+    const TraceIndex::Offsets &loads = index.getModuleLoads();
+    TraceIndex::Offsets::const_iterator lit;
+    for (lit = loads.begin(); lit != loads.end(); ++lit) {
+        if (!seek(cursor, file, *lit)) {
+            continue;
+        }
+        uint8_t *item = cursor.address + sizeof(s2e::plugins::ExecutionTraceItemHeader);
+        onModuleLoad.emit(*(s2e::plugins::ExecutionTraceModuleLoad*)item);
+    }
+
+    const TraceIndex::StateRuns &runs = index.getRuns();
+    TraceIndex::StateRuns::const_iterator rit;
+    for (rit = runs.begin(); rit != runs.end(); ++rit) {
+        if (!seek(cursor, file, (*rit).lastOffset)) {
+            continue;
+        }
+        uint8_t *last = cursor.address;
+        s2e::plugins::ExecutionTraceItemHeader *hdr = (s2e::plugins::ExecutionTraceItemHeader *)last;
+        onStateRun.emit(firstItem + (*rit).first, firstItem + (*rit).last,
+                        *hdr, last + sizeof(*hdr));
+    }
+}
+
+//Maps the file and loads its index, scanning the file if there is no
+//valid cached index. Does not modify the parser unless emitItems is set,
+//and may therefore be called from several threads at once.
+bool LogParser::loadFile(const std::string &fileName, LogFile &element,
+                         TraceIndex &index, bool emitItems, bool &complete)
+{
+    if (!mapFile(fileName, element)) {
+        return false;
+    }
+
+    std::string indexFile = TraceIndex::getIndexFileName(fileName);
+    complete = true;
+
+    //Processors connected to the parser need to see every item,
+    //the index can only be reused if there are none.
+    bool reuseIndex = UseTraceIndex && !emitItems &&
+                      index.load(indexFile) &&
+                      index.matches(element.m_size, element.m_time, m_checkpointInterval);
+
+    if (!reuseIndex) {
+        complete = scanFile(fileName, element, index, emitItems);
+
+        //Incomplete traces may still be growing, do not cache them
+        if (complete && UseTraceIndex && m_saveIndex && !index.save(indexFile)) {
+            std::cerr << "LogParser: Could not write trace index " << indexFile << std::endl;
+        }
+    }
+
     return true;
 }
 
+bool LogParser::parse(const std::string &fileName)
+{
+    LogFile element;
+    TraceIndex index;
+    bool complete;
+
+    if (!loadFile(fileName, element, index, hasItemHandlers(), complete)) {
+        return false;
+    }
+
+    addFile(element, index);
+    return complete;
+}
+
 bool LogParser::getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data)
 {
-    if (index >= m_ItemAddresses.size() ) {
+    return getItem(index, hdr, data, m_cursor);
+}
+
+bool LogParser::getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data,
+                        ItemCursor &cursor) const
+{
+    if (m_checkpoints.empty()) {
+        if (llvm::sys::CompareAndSwap(&m_noRandomAccessReported, 1, 0) == 0) {
+            std::cerr << "LogParser: random access to the trace is disabled (checkpoint interval is 0)" << std::endl;
+        }
+        return false;
+    }
+
+    if (index >= m_itemCount) {
         assert(false);
         return false;
     }
 
-    uint8_t *buffer = m_ItemAddresses[index];
+    //Find the closest checkpoint preceding the item
+    ItemCheckpoints::const_iterator it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(),
+                                                          ItemCheckpoint(index, 0, 0));
+    assert(it != m_checkpoints.begin());
+    --it;
+
+    //The cursor is in the same file if it lies between the checkpoint and the item
+    if (!cursor.address || cursor.index < (*it).index || cursor.index > index) {
+        if (!seek(cursor, (*it).file, (*it).offset)) {
+            cursor.address = NULL;
+            return false;
+        }
+        cursor.index = (*it).index;
+    }
+
+    while (cursor.index < index) {
+        if (!next(cursor)) {
+            cursor.address = NULL;
+            return false;
+        }
+        ++cursor.index;
+    }
+
+    uint8_t *buffer = cursor.address;
     hdr = *(s2e::plugins::ExecutionTraceItemHeader*)buffer;
 
     *data = NULL;
@@ -241,6 +644,110 @@ bool LogParser::getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &
     return true;
 }
 
+//Returns a new reference to the block, decompressing it if it is not
+//in the cache. Threads decompress different blocks concurrently.
+LogParser::DecodedBlock *LogParser::getBlock(unsigned file, unsigned block) const
+{
+    DecodedBlocks::iterator it;
+
+    {
+        llvm::sys::ScopedLock lock(m_blockCacheLock);
+        for (it = m_blockCache.begin(); it != m_blockCache.end(); ++it) {
+            if ((*it)->file == file && (*it)->block == block) {
+                DecodedBlock *ret = *it;
+                m_blockCache.splice(m_blockCache.begin(), m_blockCache, it);
+                llvm::sys::AtomicIncrement(&ret->refCount);
+                return ret;
+            }
+        }
+    }
+
+    const TraceContainer &container = m_files[file].m_container;
+    const TraceContainer::Block &b = container.getBlocks()[block];
+
+    DecodedBlock *ret = new DecodedBlock();
+    ret->file = file;
+    ret->block = block;
+    ret->rawOffset = b.rawOffset;
+    ret->data.resize(b.rawSize);
+
+    //One reference for the cache, one for the caller
+    ret->refCount = 2;
+
+    if (b.rawSize == 0 || !container.readBlock(block, &ret->data[0])) {
+        std::cerr << "LogParser: Could not decompress block " << block << " of file " << file << std::endl;
+        delete ret;
+        return NULL;
+    }
+
+    llvm::sys::ScopedLock lock(m_blockCacheLock);
+
+    //Another thread may have decompressed the block in the meantime
+    for (it = m_blockCache.begin(); it != m_blockCache.end(); ++it) {
+        if ((*it)->file == file && (*it)->block == block) {
+            delete ret;
+            ret = *it;
+            llvm::sys::AtomicIncrement(&ret->refCount);
+            return ret;
+        }
+    }
+
+    m_blockCache.push_front(ret);
+    while (m_blockCache.size() > m_blockCacheSize && m_blockCache.size() > 1) {
+        releaseBlock(m_blockCache.back());
+        m_blockCache.pop_back();
+    }
+
+    return ret;
+}
+
+//Points the cursor to the item at the given offset of the uncompressed file
+bool LogParser::seek(ItemCursor &cursor, unsigned file, uint64_t offset) const
+{
+    const LogFile &element = m_files[file];
+    cursor.file = file;
+
+    if (!element.m_compressed) {
+        cursor.setBlock(NULL);
+        cursor.address = (uint8_t*)element.m_File + offset;
+        return true;
+    }
+
+    if (offset >= element.m_size) {
+        return false;
+    }
+
+    DecodedBlock *block = cursor.block;
+    if (!block || block->file != file || offset < block->rawOffset ||
+        offset >= block->rawOffset + block->data.size()) {
+        block = getBlock(file, element.m_container.findBlock(offset));
+        if (!block) {
+            return false;
+        }
+        cursor.setBlock(block);
+    }
+
+    cursor.address = &block->data[0] + (offset - block->rawOffset);
+    return true;
+}
+
+//Moves the cursor to the item that follows it in the same file
+bool LogParser::next(ItemCursor &cursor) const
+{
+    uint8_t *buffer = cursor.address;
+    buffer += sizeof(s2e::plugins::ExecutionTraceItemHeader) +
+              ((s2e::plugins::ExecutionTraceItemHeader*)buffer)->size;
+
+    DecodedBlock *block = cursor.block;
+    if (!block || buffer < &block->data[0] + block->data.size()) {
+        cursor.address = buffer;
+        return true;
+    }
+
+    //Items never span blocks, the next one starts the next block
+    return seek(cursor, cursor.file, block->rawOffset + block->data.size());
+}
+
 ItemProcessorState* LogParser::getState(void *processor, ItemProcessorStateFactory f)
 {
     if (processor == m_cachedProcessor) {
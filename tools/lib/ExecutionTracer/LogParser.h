@@ -37,12 +37,18 @@
 #define S2ETOOLS_EXECTRACER_LOGPARSER_H
 
 #include <string>
+#include "llvm/Support/Atomic.h"
+#include "llvm/Support/Mutex.h"
 #include <lib/Utils/Signals/Signals.h>
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
 #include <stdio.h>
 #include <vector>
 #include <map>
 #include <set>
+#include <list>
+#include <cassert>
+
+#include "TraceContainer.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -55,12 +61,49 @@ namespace s2etools
 /**
  *  Trace item processors must use this class if they with to store
  *  aggregated data along trace processing.
+ *
+ *  States are reference counted so that the segments of a fork tree
+ *  can share them. LogEvents::getState() clones a shared state before
+ *  returning it, processors must use getConstState() when they do not
+ *  modify the state.
  */
 class ItemProcessorState
 {
+private:
+    mutable volatile llvm::sys::cas_flag m_refCount;
+
 public:
+    ItemProcessorState() {
+        m_refCount = 1;
+    }
+
+    //A copy is a new state, it is not shared
+    ItemProcessorState(const ItemProcessorState &) {
+        m_refCount = 1;
+    }
+
+    ItemProcessorState &operator=(const ItemProcessorState &) {
+        return *this;
+    }
+
     virtual ~ItemProcessorState() {};
     virtual ItemProcessorState *clone() const = 0;
+
+    void incref() const {
+        llvm::sys::AtomicIncrement(&m_refCount);
+    }
+
+    //Deletes the state when the last reference is dropped
+    void decref() const {
+        if (llvm::sys::AtomicDecrement(&m_refCount) == 0) {
+            delete this;
+        }
+    }
+
+    //Atomic read of the reference count
+    bool isShared() const {
+        return llvm::sys::CompareAndSwap(&m_refCount, 1, 1) != 1;
+    }
 };
 
 //opaque references the registered trace processor
@@ -69,19 +112,61 @@ typedef std::set<uint32_t> PathSet;
 
 typedef ItemProcessorState* (*ItemProcessorStateFactory)();
 
+class TraceIndex;
+
 class LogEvents
 {
 public:
+    typedef void (*ItemHandler)(void *processor,
+                                unsigned traceIndex,
+                                const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                                void *item);
+
+    //Slots see every item, processors that only need some item types
+    //should use subscribe() instead.
     sigc::signal<void,
         unsigned,
         const s2e::plugins::ExecutionTraceItemHeader &,
         void *
     >onEachItem;
 
+    /**
+     *  Calls processor->Method() for the items of the given type only.
+     *  The method is bound at compile time, processItem() reaches it through
+     *  a plain function call instead of the onEachItem slot list.
+     *  Handlers of a type are called in subscription order, before the
+     *  onEachItem slots.
+     */
+    template <class T, void (T::*Method)(unsigned,
+                                         const s2e::plugins::ExecutionTraceItemHeader &,
+                                         void *)>
+    void subscribe(unsigned type, T *processor) {
+        assert(type < s2e::plugins::TRACE_MAX);
+        m_handlers[type].push_back(Subscription(&callHandler<T, Method>, processor));
+        ++m_handlerCount;
+    }
+
+    //Removes all the handlers of the processor
+    void unsubscribe(void *processor);
+
+    //Whether processItem() has anything to call
+    bool hasItemHandlers() const {
+        return m_handlerCount > 0 || !onEachItem.empty();
+    }
+
+    bool hasItemHandlers(unsigned type) const {
+        return !m_handlers[type].empty() || !onEachItem.empty();
+    }
+
     virtual ItemProcessorState* getState(void *processor, ItemProcessorStateFactory f) = 0;
     virtual ItemProcessorState* getState(void *processor, uint32_t pathId) = 0;
     virtual void getPaths(PathSet &s) = 0;
 
+    //Same as getState(), for processors that only read the state
+    virtual const ItemProcessorState* getConstState(void *processor, ItemProcessorStateFactory f) {
+        return getState(processor, f);
+    }
+
 protected:
     virtual void processItem(unsigned itemEntry,
                              const s2e::plugins::ExecutionTraceItemHeader &hdr,
@@ -90,12 +175,59 @@ protected:
     LogEvents();
     virtual ~LogEvents();
 
+private:
+    struct Subscription {
+        ItemHandler handler;
+        void *processor;
+
+        Subscription(ItemHandler h, void *p) {
+            handler = h;
+            processor = p;
+        }
+    };
+
+    typedef std::vector<Subscription> Subscriptions;
+
+    template <class T, void (T::*Method)(unsigned,
+                                         const s2e::plugins::ExecutionTraceItemHeader &,
+                                         void *)>
+    static void callHandler(void *processor, unsigned traceIndex,
+                            const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                            void *item) {
+        (static_cast<T*>(processor)->*Method)(traceIndex, hdr, item);
+    }
+
+    Subscriptions m_handlers[s2e::plugins::TRACE_MAX];
+    unsigned m_handlerCount;
 };
 
 
 
 class LogParser: public LogEvents
 {
+public:
+    struct DecodedBlock;
+
+    /**
+     *  Last item returned by getItem, sequential accesses resume from there.
+     *  In a compressed file, the cursor holds a reference to the decompressed
+     *  block of the item: the item stays valid until the cursor moves.
+     */
+    struct ItemCursor {
+        unsigned index;
+        unsigned file;
+        uint8_t *address;
+        DecodedBlock *block;
+
+        ItemCursor();
+        ItemCursor(const ItemCursor &c);
+        ItemCursor &operator=(const ItemCursor &c);
+        ~ItemCursor();
+
+        //Takes over the caller's reference to the block
+        void setBlock(DecodedBlock *b);
+    };
+
 private:
 
     struct LogFile {
@@ -104,7 +236,16 @@ private:
         HANDLE m_hMapping;
         #endif
         void *m_File;
+        uint64_t m_mappedSize;
+
+        //Size of the uncompressed items
         uint64_t m_size;
+        uint64_t m_time;
+
+        //Seek table of a compressed file, whose blocks are
+        //decompressed on demand
+        bool m_compressed;
+        TraceContainer m_container;
 
         LogFile() {
             #ifdef _WIN32
@@ -112,30 +253,156 @@ private:
             m_hMapping = NULL;
             #endif
             m_File = NULL;
+            m_mappedSize = 0;
             m_size = 0;
+            m_time = 0;
+            m_compressed = false;
         }
     };
 
     typedef std::vector<LogFile> LogFiles;
 
+    /**
+     *  Sparse random-access index. There is one checkpoint every
+     *  m_checkpointInterval items, plus one at the start of each file,
+     *  so that walking forward from a checkpoint never leaves its file.
+     *  The offset is relative to the uncompressed items of the file.
+     */
+    struct ItemCheckpoint {
+        uint32_t index;
+        uint32_t file;
+        uint64_t offset;
+
+        ItemCheckpoint(uint32_t i, uint32_t f, uint64_t o) {
+            index = i;
+            file = f;
+            offset = o;
+        }
+
+        bool operator<(const ItemCheckpoint &c) const {
+            return index < c.index;
+        }
+    };
+
+    typedef std::vector<ItemCheckpoint> ItemCheckpoints;
+
+    //Most recently used blocks first
+    typedef std::list<DecodedBlock*> DecodedBlocks;
+
     LogFiles m_files;
-    std::vector<uint8_t*> m_ItemAddresses;
+    ItemCheckpoints m_checkpoints;
+    unsigned m_checkpointInterval;
+    bool m_saveIndex;
+    unsigned m_itemCount;
+    uint64_t m_typeCounts[s2e::plugins::TRACE_MAX];
+
+    ItemCursor m_cursor;
+
+    //Blocks of the compressed files that were decompressed last,
+    //shared by all the cursors
+    mutable DecodedBlocks m_blockCache;
+    unsigned m_blockCacheSize;
+    mutable llvm::sys::Mutex m_blockCacheLock;
+
+    //getItem() reports once that random access is disabled
+    mutable volatile llvm::sys::cas_flag m_noRandomAccessReported;
 
     ItemProcessors m_ItemProcessors;
     void *m_cachedProcessor;
     ItemProcessorState* m_cachedState;
 
+    struct FileLoader;
+
+    bool mapFile(const std::string &fileName, LogFile &element);
+    bool openContainer(const std::string &fileName, LogFile &element);
+    bool loadFile(const std::string &fileName, LogFile &element,
+                  TraceIndex &index, bool emitItems, bool &complete);
+    bool scanFile(const std::string &fileName, const LogFile &element,
+                  TraceIndex &index, bool emitItems);
+    bool scanItems(uint8_t *buffer, uint64_t size, uint64_t offset, unsigned &currentItem,
+                   TraceIndex &index, bool emitItems);
+    void addFile(const LogFile &element, const TraceIndex &index);
+
+    DecodedBlock *getBlock(unsigned file, unsigned block) const;
+    bool seek(ItemCursor &cursor, unsigned file, uint64_t offset) const;
+    bool next(ItemCursor &cursor) const;
+
 protected:
 
 
 public:
+    /**
+     *  Emitted in trace order for each run of consecutive items of the
+     *  same state (see TraceIndex::StateRun), with the header and the
+     *  payload of the last item of the run. Unlike onEachItem, this does
+     *  not require a scan of the trace when its index is cached.
+     */
+    sigc::signal<void,
+        unsigned,
+        unsigned,
+        const s2e::plugins::ExecutionTraceItemHeader &,
+        void *
+    >onStateRun;
+
+    /**
+     *  Emitted for each module loaded in a file of the trace as soon as
+     *  the file is indexed, before the processors see any item. Allows to
+     *  prepare per-module data (e.g., debug information) in advance.
+     */
+    sigc::signal<void,
+        const s2e::plugins::ExecutionTraceModuleLoad &
+    >onModuleLoad;
+
+    static const unsigned DEFAULT_CHECKPOINT_INTERVAL = 256;
+
     LogParser();
     virtual ~LogParser();
 
+    /**
+     *  Sets how many items separate two random-access checkpoints.
+     *  0 disables random access altogether: processors connected to the
+     *  parser still see every item in one forward pass, but getItem()
+     *  fails and the trace cannot be replayed by the PathBuilder.
+     *  Must be called before parse().
+     */
+    void setCheckpointInterval(unsigned interval) {
+        m_checkpointInterval = interval;
+    }
+
+    unsigned getCheckpointInterval() const {
+        return m_checkpointInterval;
+    }
+
+    /**
+     *  Whether the index computed for a trace is saved for later runs
+     *  (see -traceIndex). Tools that read a trace only once, e.g., to
+     *  convert it, should not replace the index of the other tools.
+     *  Must be called before parse().
+     */
+    void setSaveIndex(bool save) {
+        m_saveIndex = save;
+    }
+
+    unsigned getItemCount() const {
+        return m_itemCount;
+    }
+
+    uint64_t getTypeCount(unsigned type) const {
+        return type < s2e::plugins::TRACE_MAX ? m_typeCounts[type] : 0;
+    }
+
+    //Files may be raw traces or compressed containers (see TraceContainer).
+    //The blocks of the latter are decompressed one at a time, and only
+    //a few of them are kept in memory.
     bool parse(const std::vector<std::string> fileNames);
     bool parse(const std::string &file);
     bool getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data);
 
+    //Does not modify the parser, threads may call it concurrently
+    //as long as each uses its own cursor.
+    bool getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data,
+                 ItemCursor &cursor) const;
+
     virtual ItemProcessorState* getState(void *processor, ItemProcessorStateFactory f);
     virtual ItemProcessorState* getState(void *processor, uint32_t pathId);
     virtual void getPaths(PathSet &s);
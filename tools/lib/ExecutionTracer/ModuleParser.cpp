@@ -46,9 +46,25 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 
 namespace s2etools {
 
+namespace {
+
+//Module loads and unloads are processed by the workers of processTree().
+//Each message is formatted separately and written at once, so that the
+//messages do not interleave and the format of std::cout is not shared.
+llvm::sys::Mutex s_outputLock;
+
+void printMessage(const std::ostringstream &ss)
+{
+    llvm::sys::ScopedLock lock(s_outputLock);
+    std::cout << ss.str() << std::flush;
+}
+
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -80,13 +96,38 @@ void ModuleInstance::print(std::ostream &os) const
 
 ModuleCache::ModuleCache(LogEvents *Events)
 {
-    Events->onEachItem.connect(
-            sigc::mem_fun(*this, &ModuleCache::onItem)
-            );
+    Events->subscribe<ModuleCache, &ModuleCache::onItem>(s2e::plugins::TRACE_MOD_LOAD, this);
+    Events->subscribe<ModuleCache, &ModuleCache::onItem>(s2e::plugins::TRACE_MOD_UNLOAD, this);
+    Events->subscribe<ModuleCache, &ModuleCache::onItem>(s2e::plugins::TRACE_PROC_UNLOAD, this);
 
     m_events = Events;
 }
 
+ModuleCache::~ModuleCache()
+{
+    m_events->unsubscribe(this);
+
+    ModuleInstances::iterator it;
+    for (it = m_instances.begin(); it != m_instances.end(); ++it) {
+        delete *it;
+    }
+}
+
+//Returns the shared instance equal to the given one
+const ModuleInstance *ModuleCache::getInstance(const ModuleInstance &instance)
+{
+    llvm::sys::ScopedLock lock(m_lock);
+
+    ModuleInstances::iterator it = m_instances.find(&instance);
+    if (it != m_instances.end()) {
+        return *it;
+    }
+
+    ModuleInstance *mi = new ModuleInstance(instance);
+    m_instances.insert(mi);
+    return mi;
+}
+
 void ModuleCache::onItem(unsigned traceIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             void *item)
@@ -96,7 +137,16 @@ void ModuleCache::onItem(unsigned traceIndex,
         const s2e::plugins::ExecutionTraceModuleLoad &load = *(s2e::plugins::ExecutionTraceModuleLoad*)item;
         ModuleCacheState *state = static_cast<ModuleCacheState*>(m_events->getState(this, &ModuleCacheState::factory));
 
-        if (!state->loadModule(load.name, hdr.pid, load.loadBase, load.nativeBase, load.size)) {
+        std::ostringstream ss;
+        ss << "Loading module " << load.name << " pid=0x" << std::hex << hdr.pid <<
+                " loadBase=0x" << load.loadBase << " imageBase=0x" << load.nativeBase << " size=0x" << load.size << std::endl;
+        printMessage(ss);
+
+        uint64_t pid = Library::translatePid(hdr.pid, load.loadBase);
+        const ModuleInstance *mi = getInstance(
+                ModuleInstance(load.name, pid, load.loadBase, load.size, load.nativeBase));
+
+        if (!state->loadModule(mi)) {
             //std::cout << "Could not load driver " << load.name << std::endl;
         }
     }else if (hdr.type == s2e::plugins::TRACE_MOD_UNLOAD) {
@@ -123,47 +173,71 @@ const ModuleInstance *ModuleCacheState::getInstance(uint64_t pid, uint64_t pc) c
 {
     pid = Library::translatePid(pid, pc);
 
-    ModuleInstance mi("", pid, pc, 1, 0);
-    ModuleInstanceSet::const_iterator it = m_Instances.find(&mi);
-    if (it == m_Instances.end()) {
+    unsigned lastHit = llvm::sys::CompareAndSwap(&m_lastHit, 0, 0);
+    if (lastHit < m_Instances.size() && m_Instances[lastHit].contains(pid, pc)) {
+        return m_Instances[lastHit].Instance;
+    }
+
+    ModuleInterval probe(pid, pc, pc + 1, NULL);
+    ModuleIntervals::const_iterator it = std::lower_bound(m_Instances.begin(), m_Instances.end(), probe);
+    if (it == m_Instances.end() || probe < *it) {
         return NULL;
     }
 
-    return (*it);
+    llvm::sys::CompareAndSwap(&m_lastHit, it - m_Instances.begin(), lastHit);
+    return (*it).Instance;
 }
 
+//Returns the interval that overlaps the given range, if any
+ModuleIntervals::iterator ModuleCacheState::find(uint64_t pid, uint64_t start, uint64_t end)
+{
+    ModuleInterval probe(pid, start, end, NULL);
+    ModuleIntervals::iterator it = std::lower_bound(m_Instances.begin(), m_Instances.end(), probe);
+    if (it != m_Instances.end() && probe < *it) {
+        return m_Instances.end();
+    }
+    return it;
+}
 
-bool ModuleCacheState::loadModule(const std::string &name, uint64_t pid, uint64_t loadBase,
-                             uint64_t imageBase, uint64_t size)
+bool ModuleCacheState::loadModule(const ModuleInstance *mi)
 {
-    std::cout << "Loading module " << name << " pid=0x" << std::hex << pid <<
-            " loadBase=0x" << loadBase << " imageBase=0x" << imageBase << " size=0x" << size << std::endl;
-    pid = Library::translatePid(pid, loadBase);
+    uint64_t end = mi->LoadBase + mi->Size;
 
-    ModuleInstance *mi = new ModuleInstance(name, pid, loadBase, size, imageBase);
-    ModuleInstanceSet::iterator it = m_Instances.find(mi);
+    ModuleIntervals::iterator it = find(mi->Pid, mi->LoadBase, end);
     if (it != m_Instances.end()) {
-        ModuleInstance *found = *it;
-        std::cout << "Warning: Module already loaded (Linux exec?)\n";
+        std::ostringstream ss;
+        ss << "Warning: Module already loaded (Linux exec?)\n";
+        printMessage(ss);
         m_Instances.erase(it);
-        delete found;
     }
-    m_Instances.insert(mi);
+
+    //Same as inserting in a set, which keeps the existing element
+    //if the module still overlaps another one
+    ModuleInterval interval(mi->Pid, mi->LoadBase, end, mi);
+    it = std::lower_bound(m_Instances.begin(), m_Instances.end(), interval);
+    if (it == m_Instances.end() || interval < *it) {
+        m_Instances.insert(it, interval);
+    }
     return true;
 }
 
 bool ModuleCacheState::unloadModule(uint64_t pid, uint64_t loadBase)
 {
-    std::cout << "Unloading module pid=0x" << std::hex << pid <<
-                 " loadBase=0x" << loadBase << "\n";
+    std::ostringstream ss;
+    ss << "Unloading module pid=0x" << std::hex << pid <<
+          " loadBase=0x" << loadBase << "\n";
+    printMessage(ss);
 
     pid = Library::translatePid(pid, loadBase);
-    ModuleInstance mi("", pid, loadBase, 1, 0);
 
     //Sometimes we have duplicated items in the trace
-    //assert(m_Instances.find(&mi) != m_Instances.end());
+    ModuleIntervals::iterator it = find(pid, loadBase, loadBase + 1);
+    if (it == m_Instances.end()) {
+        return false;
+    }
 
-    return m_Instances.erase(&mi);
+    m_Instances.erase(it);
+    return true;
 }
 
 
@@ -175,7 +249,13 @@ ItemProcessorState *ModuleCacheState::factory()
 
 ModuleCacheState::ModuleCacheState()
 {
+    m_lastHit = 0;
+}
 
+ModuleCacheState::ModuleCacheState(const ModuleCacheState &s):
+        ItemProcessorState(s), m_Instances(s.m_Instances)
+{
+    m_lastHit = 0;
 }
 
 ModuleCacheState::~ModuleCacheState()
@@ -183,17 +263,10 @@ ModuleCacheState::~ModuleCacheState()
 
 }
 
+//The instances are owned by the ModuleCache and shared
 ItemProcessorState *ModuleCacheState::clone() const
 {
-    ModuleCacheState *ret = new ModuleCacheState();
-
-    ModuleInstanceSet::iterator it;
-    for (it = m_Instances.begin(); it != m_Instances.end(); ++it) {
-        ModuleInstance *newInstance = new ModuleInstance(*(*it));
-        ret->m_Instances.insert(newInstance);
-    }
-
-    return ret;
+    return new ModuleCacheState(*this);
 }
 
 }
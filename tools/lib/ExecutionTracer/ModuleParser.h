@@ -39,10 +39,13 @@
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 #include <inttypes.h>
 #include <ostream>
 #include <cassert>
 
+#include "llvm/Support/Mutex.h"
+
 #include "LogParser.h"
 
 namespace s2etools
@@ -78,7 +81,26 @@ struct ModuleInstanceCmp {
     }
 };
 
-typedef std::set<ModuleInstance*, ModuleInstanceCmp> ModuleInstanceSet;
+typedef std::set<const ModuleInstance*, ModuleInstanceCmp> ModuleInstanceSet;
+
+//Orders the instances by all their fields, equal instances are the same load
+struct ModuleInstanceIdentityCmp {
+    bool operator()(const ModuleInstance *s1, const ModuleInstance *s2) const {
+        if (s1->Pid != s2->Pid) {
+            return s1->Pid < s2->Pid;
+        }
+        if (s1->LoadBase != s2->LoadBase) {
+            return s1->LoadBase < s2->LoadBase;
+        }
+        if (s1->Size != s2->Size) {
+            return s1->Size < s2->Size;
+        }
+        if (s1->ImageBase != s2->ImageBase) {
+            return s1->ImageBase < s2->ImageBase;
+        }
+        return s1->Name < s2->Name;
+    }
+};
 
 //Represents all the loaded modules at a given time
 class ModuleCache
@@ -86,28 +108,79 @@ class ModuleCache
 private:
     LogEvents *m_events;
 
+    typedef std::set<const ModuleInstance*, ModuleInstanceIdentityCmp> ModuleInstances;
+
+    //Instances never change once created. All the loads of a module with
+    //the same parameters share one instance, including the replays of a
+    //segment and the loads that a state drops as overlapping.
+    ModuleInstances m_instances;
+    llvm::sys::Mutex m_lock;
+
+    const ModuleInstance *getInstance(const ModuleInstance &instance);
+
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
                 void *item);
 
 public:
     ModuleCache(LogEvents *Events);
+    ~ModuleCache();
+};
+
+
+/**
+ *  Address range of a loaded module. The intervals of a state are kept
+ *  sorted by pid and address in a flat array, so that lookups are a
+ *  binary search over contiguous memory.
+ */
+struct ModuleInterval
+{
+    uint64_t Pid;
+    uint64_t Start, End;
+    const ModuleInstance *Instance;
+
+    ModuleInterval(uint64_t pid, uint64_t start, uint64_t end, const ModuleInstance *instance) {
+        Pid = pid;
+        Start = start;
+        End = end;
+        Instance = instance;
+    }
+
+    bool contains(uint64_t pid, uint64_t pc) const {
+        return Pid == pid && Start <= pc && pc < End;
+    }
+
+    //Overlapping intervals are equivalent, like for ModuleInstanceCmp
+    bool operator<(const ModuleInterval &s) const {
+        if (Pid == s.Pid) {
+            return End <= s.Start;
+        }
+        return Pid < s.Pid;
+    }
 };
 
+typedef std::vector<ModuleInterval> ModuleIntervals;
 
 class ModuleCacheState: public ItemProcessorState
 {
 private:
-    ModuleInstanceSet m_Instances;
+    ModuleIntervals m_Instances;
+
+    //Position of the interval found by the last lookup. Lookups of
+    //consecutive program counters usually hit the same module.
+    //States may be shared between threads, hence the atomic accesses.
+    mutable volatile llvm::sys::cas_flag m_lastHit;
+
+    ModuleIntervals::iterator find(uint64_t pid, uint64_t start, uint64_t end);
 
 public:
     static ItemProcessorState *factory();
     ModuleCacheState();
+    ModuleCacheState(const ModuleCacheState &s);
     virtual ~ModuleCacheState();
     virtual ItemProcessorState *clone() const;
 
-    bool loadModule(const std::string &name, uint64_t pid, uint64_t loadBase,
-                    uint64_t imageBase, uint64_t size);
+    bool loadModule(const ModuleInstance *mi);
     bool unloadModule(uint64_t pid, uint64_t loadBase);
 
     const ModuleInstance *getInstance(uint64_t pid, uint64_t pc) const;
@@ -45,15 +45,15 @@ namespace s2etools {
 PageFault::PageFault(LogEvents *events, ModuleCache *mc)
 {
    m_trackModule = false;
-   m_connection = events->onEachItem.connect(
-           sigc::mem_fun(*this, &PageFault::onItem));
+   events->subscribe<PageFault, &PageFault::onItem>(s2e::plugins::TRACE_PAGEFAULT, this);
+   events->subscribe<PageFault, &PageFault::onItem>(s2e::plugins::TRACE_TLBMISS, this);
    m_events = events;
    m_mc = mc;
 }
 
 PageFault::~PageFault()
 {
-    m_connection.disconnect();
+    m_events->unsubscribe(this);
 }
 
 void PageFault::onItem(unsigned traceIndex,
@@ -65,7 +65,7 @@ void PageFault::onItem(unsigned traceIndex,
 
         ExecutionTracePageFault *pageFault = (ExecutionTracePageFault*)item;
         if (m_trackModule) {
-            ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_mc, &ModuleCacheState::factory));
+            const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_mc, &ModuleCacheState::factory));
             const ModuleInstance *mi = mcs->getInstance(hdr.pid, pageFault->pc);
             if (!mi || mi->Name != m_module) {
                 return;
@@ -81,7 +81,7 @@ void PageFault::onItem(unsigned traceIndex,
 
         ExecutionTracePageFault *tlbMiss = (ExecutionTracePageFault*)item;
         if (m_trackModule) {
-            ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_mc, &ModuleCacheState::factory));
+            const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_mc, &ModuleCacheState::factory));
             const ModuleInstance *mi = mcs->getInstance(hdr.pid, tlbMiss->pc);
             if (!mi || mi->Name != m_module) {
                 return;
@@ -45,7 +45,6 @@ namespace s2etools {
 class PageFault
 {
 private:
-    sigc::connection m_connection;
 
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
@@ -40,6 +40,8 @@
 #include <vector>
 #include <map>
 
+#include "llvm/Support/ThreadLocal.h"
+
 #include "LogParser.h"
 
 namespace s2etools
@@ -67,6 +69,7 @@ struct PathFragment
 typedef std::vector<PathFragment> PathFragmentList;
 
 class PathSegment;
+class ThreadPool;
 typedef std::vector<PathSegment *>PathSegmentList;
 typedef std::map<void *, ItemProcessorState*> PathSegmentStateMap;
 
@@ -149,16 +152,42 @@ private:
     StateToSegments m_Leaves;
     LogParser *m_Parser;
     sigc::connection m_connection;
+    bool m_replayErrorReported;
+
+    //Segment being replayed by each thread, used by getState()
+    llvm::sys::ThreadLocal<PathSegment> m_ProcessedSegment;
 
-    void onItem(unsigned traceIndex,
-                const s2e::plugins::ExecutionTraceItemHeader &hdr,
-                void *item);
+    struct SubtreeTask;
+
+    void onRun(unsigned firstIndex, unsigned lastIndex,
+               const s2e::plugins::ExecutionTraceItemHeader &hdr,
+               void *item);
 
     void processSegment(PathSegment *seg);
+    void copyParentState(PathSegment *seg);
+    void passStateToChildren(PathSegment *seg, const PathSegmentList &children);
+    void processSubtree(PathSegment *seg, ThreadPool &pool);
 public:
+    /**
+     *  Emitted by processPaths() as soon as the last segment of one of
+     *  the paths is processed. Handlers can get the state of the path
+     *  with getState(processor, pathId), and free it with releasePath()
+     *  when they are done with it.
+     */
+    sigc::signal<void, uint32_t> onPathProcessed;
+
     PathBuilder(LogParser *log);
     ~PathBuilder();
 
+    /**
+     *  Paths are replayed by random access to the items of the trace,
+     *  which requires a parser with checkpoints. Returns false, and
+     *  reports the error once, if the checkpoint interval of the parser
+     *  is 0. The process functions do not run in that case, tools should
+     *  call this before parsing the trace.
+     */
+    bool canReplay();
+
     //The paths are inverted!
     void enumeratePaths(ExecutionPaths &paths);
 
@@ -166,11 +195,22 @@ public:
     static void printPaths(const ExecutionPaths &p, std::ostream &os);
 
     bool processPath(uint32_t);
-    void processTree();
+    bool processPaths(const PathSet &paths);
+
+    //Drops the state that the trace processors kept for the path.
+    //The states of interior segments are freed once no path needs them.
+    void releasePath(uint32_t pathId);
+
+    //Sibling subtrees are processed in parallel by the -threads workers.
+    //The trace processors connected to the builder therefore run on
+    //several threads at once and must lock the data that they share
+    //between segments.
+    bool processTree();
 
     void resetTree();
     virtual ItemProcessorState* getState(void *processor, ItemProcessorStateFactory f);
     virtual ItemProcessorState* getState(void *processor, uint32_t pathId);
+    virtual const ItemProcessorState* getConstState(void *processor, ItemProcessorStateFactory f);
     virtual void getPaths(PathSet &s);
 };
 
@@ -36,10 +36,13 @@
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
 #include <cassert>
 #include <stack>
+#include <set>
 #include <ostream>
 #include <iostream>
 #include "Path.h"
 
+#include <lib/Utils/ThreadPool.h>
+
 //#define DEBUG_PB
 
 namespace s2etools
@@ -72,7 +75,7 @@ void PathSegment::deleteState()
 {
     PathSegmentStateMap::iterator it;
     for (it = m_SegmentState.begin(); it != m_SegmentState.end(); ++it){
-        delete (*it).second;
+        (*it).second->decref();
     }
     m_SegmentState.clear();
 }
@@ -115,9 +118,10 @@ void PathSegment::print(std::ostream &os) const
 PathBuilder::PathBuilder(LogParser *log)
 {
     m_Parser = log;
+    m_replayErrorReported = false;
 
-    m_connection = log->onEachItem.connect(
-            sigc::mem_fun(*this, &PathBuilder::onItem)
+    m_connection = log->onStateRun.connect(
+            sigc::mem_fun(*this, &PathBuilder::onRun)
     );
 
     m_Root = new PathSegment(NULL, 0, 0);
@@ -141,7 +145,10 @@ PathBuilder::~PathBuilder()
     }
 }
 
-void PathBuilder::onItem(unsigned traceIndex,
+//Called for each run of items [firstIndex, lastIndex] of the same state.
+//hdr and item describe the last item of the run, which is the only one
+//that can be a fork.
+void PathBuilder::onRun(unsigned firstIndex, unsigned lastIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             void *item)
 {
@@ -177,7 +184,7 @@ void PathBuilder::onItem(unsigned traceIndex,
         assert(m_CurrentSegment->getStateId() == hdr.stateId);
 
         //Since we have just switched to a new state, we must start a new fragment
-        m_CurrentSegment->appendFragment(PathFragment(traceIndex, traceIndex));
+        m_CurrentSegment->appendFragment(PathFragment(firstIndex, firstIndex));
 
         //m_CurrentSegment->print(std::cout);
     }
@@ -191,10 +198,10 @@ void PathBuilder::onItem(unsigned traceIndex,
         #ifdef DEBUG_PB
         std::cout << "Creating new fragment for segment " << m_CurrentSegment->getStateId() << std::endl;
         #endif
-        m_CurrentSegment->appendFragment(PathFragment(traceIndex, traceIndex));
+        m_CurrentSegment->appendFragment(PathFragment(firstIndex, lastIndex));
     }else
     {
-        m_CurrentSegment->expandLastFragment(traceIndex);
+        m_CurrentSegment->expandLastFragment(lastIndex);
     }
 
     #ifdef DEBUG_PB
@@ -289,6 +296,7 @@ void PathBuilder::processSegment(PathSegment *seg)
     PathFragmentList::const_iterator it;
     s2e::plugins::ExecutionTraceItemHeader hdr;
     uint8_t *data;
+    LogParser::ItemCursor cursor;
 
     #ifdef DEBUG_PB
     std::cout << std::dec << "Processing segment of state " << seg->getStateId() << " ";
@@ -307,8 +315,9 @@ void PathBuilder::processSegment(PathSegment *seg)
         std::cout << std::dec << "sid=" << seg->getStateId() <<  " frag(" << f.startIndex << "," << f.endIndex << ")"<< std::endl;
         #endif
         for (uint32_t s = f.startIndex; s <= f.endIndex; ++s) {
-            if (!m_Parser->getItem(s, hdr, (void**)&data)) {
+            if (!m_Parser->getItem(s, hdr, (void**)&data, cursor)) {
                 assert(false && "Trace is broken");
+                return;
             }
             #ifdef DEBUG_PB
             //std::cout << "T: " << (unsigned)hdr.type << std::endl;
@@ -319,8 +328,27 @@ void PathBuilder::processSegment(PathSegment *seg)
     }
 }
 
+//Paths are replayed by random access to the items of the trace,
+//which the parser only supports if it keeps checkpoints.
+bool PathBuilder::canReplay()
+{
+    if (m_Parser->getCheckpointInterval() != 0) {
+        return true;
+    }
+
+    if (!m_replayErrorReported) {
+        std::cerr << "PathBuilder: the trace cannot be replayed with a checkpoint interval of 0" << std::endl;
+        m_replayErrorReported = true;
+    }
+    return false;
+}
+
 bool PathBuilder::processPath(uint32_t pathId)
 {
+    if (!canReplay()) {
+        return false;
+    }
+
     resetTree();
 
     StateToSegments::iterator it;
@@ -337,25 +365,84 @@ bool PathBuilder::processPath(uint32_t pathId)
     }
 
     for (int i=segments.size()-1; i>=0; --i) {
-        m_CurrentSegment = segments[i];
-
-        if (m_CurrentSegment->getParent()) {
-            //Copy the trace analyzer's state from the parent
-            //to the current segment.
-            assert(m_CurrentSegment->getStateMap().empty());
-            PathSegmentStateMap &pm = m_CurrentSegment->getParent()->getStateMap();
-            PathSegmentStateMap &m = m_CurrentSegment->getStateMap();
-
-            PathSegmentStateMap::iterator it;
-            for (it = pm.begin(); it != pm.end(); ++it) {
-                m[(*it).first] = (*it).second->clone();
+        m_ProcessedSegment.set(segments[i]);
+        processSegment(segments[i]);
+
+        if (i > 0) {
+            passStateToChildren(segments[i], PathSegmentList(1, segments[i-1]));
+        }
+    }
+
+    return true;
+}
+
+//Processes the given paths in one pass. Segments shared by several paths
+//are processed only once, the state of each path is then available
+//through getState(processor, pathId).
+bool PathBuilder::processPaths(const PathSet &paths)
+{
+    if (!canReplay()) {
+        return false;
+    }
+
+    resetTree();
+
+    bool ret = true;
+    std::set<PathSegment*> selected;
+
+    PathSet::const_iterator pit;
+    for (pit = paths.begin(); pit != paths.end(); ++pit) {
+        StateToSegments::iterator it = m_Leaves.find(*pit);
+        if (it == m_Leaves.end()) {
+            ret = false;
+            continue;
+        }
+
+        PathSegment *seg = (*it).second.back();
+        while (seg && selected.insert(seg).second) {
+            seg = seg->getParent();
+        }
+    }
+
+    std::stack<PathSegment*> s;
+    if (!selected.empty()) {
+        s.push(m_Root);
+    }
+
+    while (s.size() > 0) {
+        PathSegment *curSeg = s.top();
+        s.pop();
+
+        m_ProcessedSegment.set(curSeg);
+        processSegment(curSeg);
+
+        const PathSegmentList &children = curSeg->getChildren();
+        PathSegmentList next;
+        PathSegmentList::const_iterator it;
+        for (it = children.begin(); it != children.end(); ++it) {
+            if (selected.count(*it)) {
+                next.push_back(*it);
+                s.push(*it);
             }
         }
 
-        processSegment(segments[i]);
+        passStateToChildren(curSeg, next);
+
+        //Only the last segment of a selected path has no children
+        if (next.empty()) {
+            onPathProcessed.emit(curSeg->getStateId());
+        }
     }
 
-    return true;
+    return ret;
+}
+
+void PathBuilder::releasePath(uint32_t pathId)
+{
+    StateToSegments::iterator it = m_Leaves.find(pathId);
+    if (it != m_Leaves.end()) {
+        (*it).second.back()->deleteState();
+    }
 }
 
 //Discards all segment-local information kept by trace processors.
@@ -373,37 +460,118 @@ void PathBuilder::resetTree()
     }
 }
 
-void PathBuilder::processTree()
+//Share the trace analyzer's state of the parent with the given segment.
+//The state is cloned by getState() when the segment first modifies it.
+void PathBuilder::copyParentState(PathSegment *seg)
 {
-    ExecutionPath currentPath;
+    if (!seg->getParent()) {
+        return;
+    }
+
+    assert(seg->getStateMap().empty());
+    PathSegmentStateMap &pm = seg->getParent()->getStateMap();
+    PathSegmentStateMap &m = seg->getStateMap();
+
+    PathSegmentStateMap::iterator it;
+    for (it = pm.begin(); it != pm.end(); ++it) {
+        (*it).second->incref();
+        m[(*it).first] = (*it).second;
+    }
+}
+
+//Hands the state of a processed segment over to the children that are
+//going to be processed. Interior segments do not need their state anymore,
+//only the leaves keep it for getState(processor, pathId). This bounds the
+//number of live states by the depth of the tree rather than its size.
+void PathBuilder::passStateToChildren(PathSegment *seg, const PathSegmentList &children)
+{
+    if (children.empty()) {
+        return;
+    }
+
+    PathSegmentList::const_iterator it;
+    for (it = children.begin(); it != children.end(); ++it) {
+        copyParentState(*it);
+    }
+
+    seg->deleteState();
+}
+
+//Processes a subtree of the fork tree on a worker thread
+struct PathBuilder::SubtreeTask: public ThreadPoolTask
+{
+    PathBuilder *builder;
+    PathSegment *root;
+    ThreadPool *pool;
+
+    SubtreeTask(PathBuilder *b, PathSegment *r, ThreadPool *p) {
+        builder = b;
+        root = r;
+        pool = p;
+    }
+
+    void run() {
+        builder->processSubtree(root, *pool);
+        delete this;
+    }
+};
+
+//Once the parent segment is done, sibling subtrees are independent.
+//The current thread follows the first child and hands the other ones
+//to idle workers.
+void PathBuilder::processSubtree(PathSegment *seg, ThreadPool &pool)
+{
+    while (seg) {
+        m_ProcessedSegment.set(seg);
+        processSegment(seg);
+
+        const PathSegmentList &children = seg->getChildren();
+        if (children.empty()) {
+            break;
+        }
+
+        //Done before the children can run on other threads
+        passStateToChildren(seg, children);
+
+        for (unsigned i = 1; i < children.size(); ++i) {
+            pool.submit(new SubtreeTask(this, children[i], &pool));
+        }
+
+        seg = children[0];
+    }
+
+    m_ProcessedSegment.erase();
+}
+
+bool PathBuilder::processTree()
+{
+    if (!canReplay()) {
+        return false;
+    }
+
+    if (ThreadPool::getDefaultThreadCount() > 1) {
+        ThreadPool pool;
+        pool.submit(new SubtreeTask(this, m_Root, &pool));
+        pool.wait();
+        return true;
+    }
+
     std::stack<PathSegment*> s;
 
     s.push(m_Root);
 
     while(s.size()>0) {
         PathSegment *curSeg = s.top();
-        m_CurrentSegment = curSeg;
+        m_ProcessedSegment.set(curSeg);
         s.pop();
 
-        if (curSeg->getParent()) {
-            //Copy the trace analyzer's state from the parent
-            //to the current segment. This assumes that we process segments in
-            //depth-first order.
-            assert(curSeg->getStateMap().empty());
-            PathSegmentStateMap &pm = curSeg->getParent()->getStateMap();
-            PathSegmentStateMap &m = curSeg->getStateMap();
-
-            PathSegmentStateMap::iterator it;
-            for (it = pm.begin(); it != pm.end(); ++it) {
-                m[(*it).first] = (*it).second->clone();
-            }
-        }
-
         processSegment(curSeg);
 
         const PathSegmentList &children = curSeg->getChildren();
         PathSegmentList::const_iterator it;
 
+        passStateToChildren(curSeg, children);
+
         //assert(children.size() == 0 || children.size() == 2);
 
         if (children.size() > 0) {
@@ -412,11 +580,42 @@ void PathBuilder::processTree()
             }
         }
     }
+
+    return true;
 }
 
+//Returns the state of the segment processed by the calling thread,
+//ready to be modified.
 ItemProcessorState* PathBuilder::getState(void *processor, ItemProcessorStateFactory f)
 {
-    PathSegmentStateMap &m = m_CurrentSegment->getStateMap();
+    PathSegment *seg = m_ProcessedSegment.get();
+    assert(seg);
+
+    PathSegmentStateMap &m = seg->getStateMap();
+    PathSegmentStateMap::iterator it = m.find(processor);
+    if (it != m.end()) {
+        ItemProcessorState *s = (*it).second;
+        if (s->isShared()) {
+            //Other segments still see the original state
+            ItemProcessorState *copy = s->clone();
+            s->decref();
+            (*it).second = copy;
+            return copy;
+        }
+        return s;
+    }
+
+    ItemProcessorState *s = f();
+    m[processor] = s;
+    return s;
+}
+
+const ItemProcessorState* PathBuilder::getConstState(void *processor, ItemProcessorStateFactory f)
+{
+    PathSegment *seg = m_ProcessedSegment.get();
+    assert(seg);
+
+    PathSegmentStateMap &m = seg->getStateMap();
     PathSegmentStateMap::iterator it = m.find(processor);
     if (it != m.end()) {
         return (*it).second;
@@ -44,24 +44,19 @@ namespace s2etools {
 
 TestCase::TestCase(LogEvents *events)
 {
-   m_connection = events->onEachItem.connect(
-           sigc::mem_fun(*this, &TestCase::onItem));
+   events->subscribe<TestCase, &TestCase::onItem>(s2e::plugins::TRACE_TESTCASE, this);
    m_events = events;
 }
 
 TestCase::~TestCase()
 {
-    m_connection.disconnect();
+    m_events->unsubscribe(this);
 }
 
 void TestCase::onItem(unsigned traceIndex,
         const s2e::plugins::ExecutionTraceItemHeader &hdr,
         void *item)
 {
-    if (hdr.type != s2e::plugins::TRACE_TESTCASE) {
-        return;
-    }
-
     TestCaseState *state = static_cast<TestCaseState*>(m_events->getState(this, &TestCaseState::factory));
 
     std::cerr << "TestCase stateId=" << hdr.stateId << std::endl;
@@ -0,0 +1,307 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <string.h>
+#include <cassert>
+#include <zlib.h>
+#include "TraceContainer.h"
+
+using namespace s2e::plugins;
+
+namespace s2etools
+{
+
+namespace {
+
+struct TraceContainerHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t reserved;
+};
+
+struct TraceContainerTrailer {
+    uint64_t rawSize;
+    uint64_t tableOffset;
+    uint32_t blockCount;
+    uint32_t itemCount;
+    uint32_t magic;
+    uint32_t reserved;
+};
+
+//Checks that size bytes at offset lie inside a file of the given size
+bool fits(uint64_t offset, uint64_t size, uint64_t fileSize)
+{
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+}
+
+const uint32_t TraceContainer::MAGIC;
+const uint32_t TraceContainer::VERSION;
+const uint32_t TraceContainer::DEFAULT_BLOCK_SIZE;
+
+TraceContainer::TraceContainer()
+{
+    m_data = NULL;
+    m_size = 0;
+    m_rawSize = 0;
+    m_itemCount = 0;
+}
+
+bool TraceContainer::isContainer(const void *data, uint64_t size)
+{
+    TraceContainerHeader hdr;
+    if (size < sizeof(hdr)) {
+        return false;
+    }
+
+    memcpy(&hdr, data, sizeof(hdr));
+    return hdr.magic == MAGIC;
+}
+
+bool TraceContainer::open(const void *data, uint64_t size)
+{
+    TraceContainerHeader hdr;
+    TraceContainerTrailer trailer;
+
+    if (size < sizeof(hdr) + sizeof(trailer)) {
+        return false;
+    }
+
+    m_data = (const uint8_t*)data;
+    m_size = size;
+
+    memcpy(&hdr, m_data, sizeof(hdr));
+    memcpy(&trailer, m_data + size - sizeof(trailer), sizeof(trailer));
+
+    if (hdr.magic != MAGIC || hdr.version != VERSION || trailer.magic != MAGIC) {
+        return false;
+    }
+
+    uint64_t tableSize = (uint64_t)trailer.blockCount * sizeof(Block);
+    if (trailer.tableOffset < sizeof(hdr) ||
+        !fits(trailer.tableOffset, tableSize, size - sizeof(trailer)) ||
+        trailer.tableOffset + tableSize != size - sizeof(trailer)) {
+        return false;
+    }
+
+    m_blocks.resize(trailer.blockCount);
+    if (tableSize > 0) {
+        memcpy(&m_blocks[0], m_data + trailer.tableOffset, tableSize);
+    }
+
+    //The blocks must cover the trace without gaps
+    uint64_t rawOffset = 0;
+    uint32_t itemCount = 0;
+    Blocks::const_iterator it;
+    for (it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+        const Block &b = *it;
+        if (b.rawOffset != rawOffset || b.firstItem != itemCount ||
+            b.fileOffset < sizeof(hdr) ||
+            !fits(b.fileOffset, b.compressedSize, trailer.tableOffset)) {
+            m_blocks.clear();
+            return false;
+        }
+        rawOffset += b.rawSize;
+        itemCount += b.itemCount;
+    }
+
+    if (rawOffset != trailer.rawSize || itemCount != trailer.itemCount) {
+        m_blocks.clear();
+        return false;
+    }
+
+    m_rawSize = trailer.rawSize;
+    m_itemCount = trailer.itemCount;
+    return true;
+}
+
+unsigned TraceContainer::findBlock(uint64_t rawOffset) const
+{
+    assert(rawOffset < m_rawSize);
+
+    unsigned low = 0, high = m_blocks.size();
+    while (high - low > 1) {
+        unsigned mid = (low + high) / 2;
+        if (m_blocks[mid].rawOffset <= rawOffset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+bool TraceContainer::readBlock(unsigned block, void *buffer) const
+{
+    assert(block < m_blocks.size());
+    const Block &b = m_blocks[block];
+
+    uLongf size = b.rawSize;
+    int ret = uncompress((Bytef*)buffer, &size, m_data + b.fileOffset, b.compressedSize);
+    return ret == Z_OK && size == b.rawSize;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+TraceContainerWriter::TraceContainerWriter(unsigned blockSize, int level)
+{
+    m_fp = NULL;
+    m_blockSize = blockSize;
+    m_level = level;
+    m_blockItemCount = 0;
+    m_rawSize = 0;
+    m_fileSize = 0;
+    m_itemCount = 0;
+}
+
+TraceContainerWriter::~TraceContainerWriter()
+{
+    if (m_fp) {
+        fclose(m_fp);
+    }
+}
+
+bool TraceContainerWriter::open(const std::string &fileName)
+{
+    assert(!m_fp);
+
+    m_fp = fopen(fileName.c_str(), "wb");
+    if (!m_fp) {
+        return false;
+    }
+
+    TraceContainerHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TraceContainer::MAGIC;
+    hdr.version = TraceContainer::VERSION;
+    hdr.blockSize = m_blockSize;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, m_fp) != 1) {
+        return false;
+    }
+
+    m_fileSize = sizeof(hdr);
+    return true;
+}
+
+bool TraceContainerWriter::flushBlock()
+{
+    if (m_block.empty()) {
+        return true;
+    }
+
+    uLongf compressedSize = compressBound(m_block.size());
+    std::vector<uint8_t> compressed(compressedSize);
+
+    if (compress2(&compressed[0], &compressedSize, &m_block[0], m_block.size(), m_level) != Z_OK) {
+        return false;
+    }
+
+    if (fwrite(&compressed[0], compressedSize, 1, m_fp) != 1) {
+        return false;
+    }
+
+    TraceContainer::Block b;
+    b.rawOffset = m_rawSize;
+    b.fileOffset = m_fileSize;
+    b.rawSize = m_block.size();
+    b.compressedSize = compressedSize;
+    b.firstItem = m_itemCount;
+    b.itemCount = m_blockItemCount;
+    m_blocks.push_back(b);
+
+    m_rawSize += b.rawSize;
+    m_fileSize += b.compressedSize;
+    m_itemCount += b.itemCount;
+
+    m_block.clear();
+    m_blockItemCount = 0;
+    return true;
+}
+
+bool TraceContainerWriter::addItem(const ExecutionTraceItemHeader &hdr, const void *payload)
+{
+    assert(m_fp);
+
+    unsigned itemSize = sizeof(hdr) + hdr.size;
+    if (!m_block.empty() && m_block.size() + itemSize > m_blockSize) {
+        if (!flushBlock()) {
+            return false;
+        }
+    }
+
+    const uint8_t *h = (const uint8_t*)&hdr;
+    m_block.insert(m_block.end(), h, h + sizeof(hdr));
+    if (hdr.size > 0) {
+        const uint8_t *p = (const uint8_t*)payload;
+        m_block.insert(m_block.end(), p, p + hdr.size);
+    }
+
+    ++m_blockItemCount;
+    return true;
+}
+
+bool TraceContainerWriter::close()
+{
+    assert(m_fp);
+
+    bool ok = flushBlock();
+
+    TraceContainerTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.rawSize = m_rawSize;
+    trailer.tableOffset = m_fileSize;
+    trailer.blockCount = m_blocks.size();
+    trailer.itemCount = m_itemCount;
+    trailer.magic = TraceContainer::MAGIC;
+
+    if (ok && !m_blocks.empty()) {
+        ok = fwrite(&m_blocks[0], sizeof(TraceContainer::Block), m_blocks.size(), m_fp) == m_blocks.size();
+        m_fileSize += m_blocks.size() * sizeof(TraceContainer::Block);
+    }
+
+    ok = ok && fwrite(&trailer, sizeof(trailer), 1, m_fp) == 1;
+    m_fileSize += sizeof(trailer);
+
+    ok = (fclose(m_fp) == 0) && ok;
+    m_fp = NULL;
+    return ok;
+}
+
+}
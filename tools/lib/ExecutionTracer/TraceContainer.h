@@ -0,0 +1,158 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_EXECTRACER_TRACECONTAINER_H
+#define S2ETOOLS_EXECTRACER_TRACECONTAINER_H
+
+#include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace s2etools
+{
+
+/**
+ *  Block-compressed ExecutionTracer.dat file.
+ *
+ *  The file starts with a header, followed by the compressed blocks,
+ *  the seek table (one Block per block) and a trailer that locates the
+ *  seek table. Each block is a zlib stream of whole trace items, so any
+ *  block can be decompressed and scanned on its own.
+ *
+ *  Offsets in the Block structures refer to the uncompressed trace
+ *  (rawOffset) and to the container file (fileOffset).
+ */
+class TraceContainer
+{
+public:
+    static const uint32_t MAGIC = 0x5a525453; //"STRZ"
+    static const uint32_t VERSION = 1;
+    static const uint32_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    struct Block {
+        uint64_t rawOffset;
+        uint64_t fileOffset;
+        uint32_t rawSize;
+        uint32_t compressedSize;
+        uint32_t firstItem;
+        uint32_t itemCount;
+    };
+
+    typedef std::vector<Block> Blocks;
+
+private:
+    const uint8_t *m_data;
+    uint64_t m_size;
+    uint64_t m_rawSize;
+    uint32_t m_itemCount;
+    Blocks m_blocks;
+
+public:
+    TraceContainer();
+
+    //Checks the magic number at the start of a mapped file
+    static bool isContainer(const void *data, uint64_t size);
+
+    //Reads the seek table of a mapped container. The mapping must
+    //outlive this object.
+    bool open(const void *data, uint64_t size);
+
+    uint64_t getRawSize() const {
+        return m_rawSize;
+    }
+
+    uint32_t getItemCount() const {
+        return m_itemCount;
+    }
+
+    const Blocks &getBlocks() const {
+        return m_blocks;
+    }
+
+    //Returns the block that contains the given uncompressed offset
+    unsigned findBlock(uint64_t rawOffset) const;
+
+    //Decompresses one block, buffer must hold Block::rawSize bytes
+    bool readBlock(unsigned block, void *buffer) const;
+};
+
+/**
+ *  Writes a TraceContainer item by item. Items are never split across
+ *  blocks, a block is closed when the next item does not fit in it.
+ */
+class TraceContainerWriter
+{
+private:
+    FILE *m_fp;
+    unsigned m_blockSize;
+    int m_level;
+
+    std::vector<uint8_t> m_block;
+    uint32_t m_blockItemCount;
+
+    TraceContainer::Blocks m_blocks;
+    uint64_t m_rawSize;
+    uint64_t m_fileSize;
+    uint32_t m_itemCount;
+
+    bool flushBlock();
+
+public:
+    //level is the zlib compression level, -1 is the zlib default
+    TraceContainerWriter(unsigned blockSize = TraceContainer::DEFAULT_BLOCK_SIZE,
+                         int level = -1);
+    ~TraceContainerWriter();
+
+    bool open(const std::string &fileName);
+
+    bool addItem(const s2e::plugins::ExecutionTraceItemHeader &hdr, const void *payload);
+
+    //Writes the pending block and the seek table
+    bool close();
+
+    uint64_t getRawSize() const {
+        return m_rawSize;
+    }
+
+    uint64_t getFileSize() const {
+        return m_fileSize;
+    }
+};
+
+}
+
+#endif
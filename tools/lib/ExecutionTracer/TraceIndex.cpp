@@ -0,0 +1,294 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include "TraceIndex.h"
+
+#include <lib/Utils/TemporaryFile.h>
+
+using namespace s2e::plugins;
+
+namespace s2etools
+{
+
+namespace {
+
+//On-disk layout of the sidecar, followed by the type counts,
+//the checkpoints, the state runs and the module loads.
+struct TraceIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t traceSize;
+    uint64_t traceTime;
+    uint32_t itemCount;
+    uint32_t checkpointInterval;
+    uint32_t typeCount;
+    uint32_t checkpointCount;
+    uint32_t runCount;
+    uint32_t moduleLoadCount;
+};
+
+//Checks that size bytes at offset lie inside a file of the given size
+bool fits(uint64_t offset, uint64_t size, uint64_t fileSize)
+{
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+}
+
+const uint32_t TraceIndex::MAGIC;
+const uint32_t TraceIndex::VERSION;
+
+TraceIndex::TraceIndex()
+{
+    reset(0, 0, 0);
+}
+
+void TraceIndex::reset(uint64_t traceSize, uint64_t traceTime, unsigned checkpointInterval)
+{
+    m_traceSize = traceSize;
+    m_traceTime = traceTime;
+    m_itemCount = 0;
+    m_checkpointInterval = checkpointInterval;
+    memset(m_typeCounts, 0, sizeof(m_typeCounts));
+    m_checkpoints.clear();
+    m_runs.clear();
+    m_moduleLoads.clear();
+    m_hasOpenRun = false;
+    m_openRunState = 0;
+}
+
+void TraceIndex::addItem(const ExecutionTraceItemHeader &hdr, uint64_t offset)
+{
+    uint32_t index = m_itemCount++;
+
+    if (m_checkpointInterval && (index % m_checkpointInterval) == 0) {
+        Checkpoint cp;
+        cp.index = index;
+        cp.reserved = 0;
+        cp.offset = offset;
+        m_checkpoints.push_back(cp);
+    }
+
+    if (hdr.type < TRACE_MAX) {
+        ++m_typeCounts[hdr.type];
+    }
+
+    if (hdr.type == TRACE_MOD_LOAD) {
+        m_moduleLoads.push_back(offset);
+    }
+
+    if (m_hasOpenRun && m_openRunState != hdr.stateId) {
+        finalize();
+    }
+
+    if (!m_hasOpenRun) {
+        m_hasOpenRun = true;
+        m_openRunState = hdr.stateId;
+        m_openRun.first = index;
+    }
+
+    m_openRun.last = index;
+    m_openRun.lastOffset = offset;
+
+    //Forks terminate the segment of the current state
+    if (hdr.type == TRACE_FORK) {
+        finalize();
+    }
+}
+
+void TraceIndex::finalize()
+{
+    if (m_hasOpenRun) {
+        m_runs.push_back(m_openRun);
+        m_hasOpenRun = false;
+    }
+}
+
+bool TraceIndex::load(const std::string &indexFile)
+{
+    FILE *fp = fopen(indexFile.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    //The counts are checked against the size of the file before
+    //anything is allocated for them
+    TraceIndexHeader hdr;
+    bool ok = fseek(fp, 0, SEEK_END) == 0;
+    uint64_t fileSize = ok ? ftell(fp) : 0;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 &&
+         fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+         hdr.magic == MAGIC && hdr.version == VERSION &&
+         hdr.typeCount == TRACE_MAX &&
+         fileSize == sizeof(hdr) + sizeof(m_typeCounts) +
+                     (uint64_t)hdr.checkpointCount * sizeof(Checkpoint) +
+                     (uint64_t)hdr.runCount * sizeof(StateRun) +
+                     (uint64_t)hdr.moduleLoadCount * sizeof(uint64_t);
+
+    if (ok) {
+        reset(hdr.traceSize, hdr.traceTime, hdr.checkpointInterval);
+        m_itemCount = hdr.itemCount;
+        m_checkpoints.resize(hdr.checkpointCount);
+        m_runs.resize(hdr.runCount);
+        m_moduleLoads.resize(hdr.moduleLoadCount);
+
+        ok = fread(m_typeCounts, sizeof(m_typeCounts), 1, fp) == 1;
+        if (ok && hdr.checkpointCount) {
+            ok = fread(&m_checkpoints[0], sizeof(Checkpoint), hdr.checkpointCount, fp) == hdr.checkpointCount;
+        }
+        if (ok && hdr.runCount) {
+            ok = fread(&m_runs[0], sizeof(StateRun), hdr.runCount, fp) == hdr.runCount;
+        }
+        if (ok && hdr.moduleLoadCount) {
+            ok = fread(&m_moduleLoads[0], sizeof(uint64_t), hdr.moduleLoadCount, fp) == hdr.moduleLoadCount;
+        }
+        ok = ok && validate();
+    }
+
+    fclose(fp);
+
+    if (!ok) {
+        reset(0, 0, 0);
+    }
+    return ok;
+}
+
+//Checks that all the indexes and offsets lie inside the trace, so that
+//a foreign or corrupted index cannot make the parser read outside of it
+bool TraceIndex::validate() const
+{
+    const uint64_t hdrSize = sizeof(ExecutionTraceItemHeader);
+
+    if ((uint64_t)m_itemCount * hdrSize > m_traceSize) {
+        return false;
+    }
+
+    uint64_t expectedCheckpoints = 0;
+    if (m_checkpointInterval) {
+        expectedCheckpoints = ((uint64_t)m_itemCount + m_checkpointInterval - 1) / m_checkpointInterval;
+    }
+
+    if (m_checkpoints.size() != expectedCheckpoints) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < m_checkpoints.size(); ++i) {
+        const Checkpoint &cp = m_checkpoints[i];
+        if (cp.index != (uint64_t)i * m_checkpointInterval || cp.index >= m_itemCount ||
+            !fits(cp.offset, hdrSize, m_traceSize)) {
+            return false;
+        }
+        if (i > 0 && cp.offset <= m_checkpoints[i - 1].offset) {
+            return false;
+        }
+    }
+
+    for (unsigned i = 0; i < m_runs.size(); ++i) {
+        const StateRun &run = m_runs[i];
+        if (run.first > run.last || run.last >= m_itemCount ||
+            !fits(run.lastOffset, hdrSize, m_traceSize)) {
+            return false;
+        }
+        if (i > 0 && (run.first <= m_runs[i - 1].last || run.lastOffset <= m_runs[i - 1].lastOffset)) {
+            return false;
+        }
+    }
+
+    for (unsigned i = 0; i < m_moduleLoads.size(); ++i) {
+        if (!fits(m_moduleLoads[i], hdrSize + sizeof(ExecutionTraceModuleLoad), m_traceSize)) {
+            return false;
+        }
+        if (i > 0 && m_moduleLoads[i] <= m_moduleLoads[i - 1]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TraceIndex::save(const std::string &indexFile) const
+{
+    assert(!m_hasOpenRun);
+
+    //Write to a temporary file first, concurrent tool runs must never
+    //see a partially written index.
+    std::string tmpFile = getTemporaryFileName(indexFile);
+    FILE *fp = fopen(tmpFile.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    TraceIndexHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MAGIC;
+    hdr.version = VERSION;
+    hdr.traceSize = m_traceSize;
+    hdr.traceTime = m_traceTime;
+    hdr.itemCount = m_itemCount;
+    hdr.checkpointInterval = m_checkpointInterval;
+    hdr.typeCount = TRACE_MAX;
+    hdr.checkpointCount = m_checkpoints.size();
+    hdr.runCount = m_runs.size();
+    hdr.moduleLoadCount = m_moduleLoads.size();
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(m_typeCounts, sizeof(m_typeCounts), 1, fp) == 1;
+
+    if (ok && !m_checkpoints.empty()) {
+        ok = fwrite(&m_checkpoints[0], sizeof(Checkpoint), m_checkpoints.size(), fp) == m_checkpoints.size();
+    }
+
+    if (ok && !m_runs.empty()) {
+        ok = fwrite(&m_runs[0], sizeof(StateRun), m_runs.size(), fp) == m_runs.size();
+    }
+
+    if (ok && !m_moduleLoads.empty()) {
+        ok = fwrite(&m_moduleLoads[0], sizeof(uint64_t), m_moduleLoads.size(), fp) == m_moduleLoads.size();
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmpFile.c_str(), indexFile.c_str()) != 0) {
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}
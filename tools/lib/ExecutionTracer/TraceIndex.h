@@ -0,0 +1,149 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_EXECTRACER_TRACEINDEX_H
+#define S2ETOOLS_EXECTRACER_TRACEINDEX_H
+
+#include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+namespace s2etools
+{
+
+/**
+ *  Summary of a single ExecutionTracer.dat file, computed by one scan
+ *  over the file and cached in a sidecar (<trace>.idx) so that later
+ *  runs do not have to rescan the trace.
+ *
+ *  All item indexes and offsets are relative to the start of the file.
+ */
+class TraceIndex
+{
+public:
+    static const uint32_t MAGIC = 0x58444953; //"SIDX"
+    static const uint32_t VERSION = 2;
+
+    struct Checkpoint {
+        uint32_t index;
+        //Always 0, keeps the .idx files deterministic
+        uint32_t reserved;
+        uint64_t offset;
+    };
+
+    /**
+     *  Maximal sequence of consecutive items of the same state that does
+     *  not contain a fork, except as its last item. This is all that the
+     *  PathBuilder needs to rebuild the fork tree (segments and fragments)
+     *  without looking at each item.
+     */
+    struct StateRun {
+        uint32_t first, last;
+        //Offset of the header of the last item
+        uint64_t lastOffset;
+    };
+
+    typedef std::vector<Checkpoint> Checkpoints;
+    typedef std::vector<StateRun> StateRuns;
+    typedef std::vector<uint64_t> Offsets;
+
+private:
+    uint64_t m_traceSize;
+    uint64_t m_traceTime;
+    uint32_t m_itemCount;
+    uint32_t m_checkpointInterval;
+    uint64_t m_typeCounts[s2e::plugins::TRACE_MAX];
+
+    Checkpoints m_checkpoints;
+    StateRuns m_runs;
+    Offsets m_moduleLoads;
+
+    //Run being built by addItem()
+    bool m_hasOpenRun;
+    uint32_t m_openRunState;
+    StateRun m_openRun;
+
+    bool validate() const;
+
+public:
+    TraceIndex();
+
+    void reset(uint64_t traceSize, uint64_t traceTime, unsigned checkpointInterval);
+
+    //Must be called for each item of the file, in order
+    void addItem(const s2e::plugins::ExecutionTraceItemHeader &hdr, uint64_t offset);
+
+    //Must be called after the last item of the file
+    void finalize();
+
+    bool load(const std::string &indexFile);
+    bool save(const std::string &indexFile) const;
+
+    //Checks that the index describes the given version of the trace
+    bool matches(uint64_t traceSize, uint64_t traceTime, unsigned checkpointInterval) const {
+        return m_traceSize == traceSize && m_traceTime == traceTime &&
+               m_checkpointInterval == checkpointInterval;
+    }
+
+    uint32_t getItemCount() const {
+        return m_itemCount;
+    }
+
+    uint64_t getTypeCount(unsigned type) const {
+        return type < s2e::plugins::TRACE_MAX ? m_typeCounts[type] : 0;
+    }
+
+    const Checkpoints &getCheckpoints() const {
+        return m_checkpoints;
+    }
+
+    const StateRuns &getRuns() const {
+        return m_runs;
+    }
+
+    //Offsets of the TRACE_MOD_LOAD items
+    const Offsets &getModuleLoads() const {
+        return m_moduleLoads;
+    }
+
+    static std::string getIndexFileName(const std::string &traceFile) {
+        return traceFile + ".idx";
+    }
+};
+
+}
+
+#endif
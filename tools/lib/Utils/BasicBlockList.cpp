@@ -0,0 +1,331 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+#define __STDC_FORMAT_MACROS 1
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <set>
+
+#include "BasicBlockList.h"
+#include "TemporaryFile.h"
+
+namespace s2etools
+{
+
+namespace {
+
+//On-disk layout of the cache. The header is followed by the start and
+//end addresses of the blocks, the overlaps, the function of each block,
+//the offsets of the function names and the names.
+struct BasicBlockListHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t listSize;
+    uint64_t listTime;
+    uint32_t blockCount;
+    uint32_t overlapCount;
+    uint32_t functionCount;
+    uint32_t stringsSize;
+};
+
+typedef std::map<std::string, uint32_t> FunctionIds;
+
+struct ParsedBlock {
+    uint64_t start;
+    uint64_t end;
+    //Not part of the ordering
+    mutable FunctionIds::iterator function;
+
+    //Overlapping blocks are equivalent
+    bool operator()(const ParsedBlock &b1, const ParsedBlock &b2) const {
+        return b1.end < b2.start;
+    }
+};
+
+template <class T>
+char *copyArray(char *out, const std::vector<T> &v)
+{
+    if (!v.empty()) {
+        memcpy(out, &v[0], v.size() * sizeof(T));
+    }
+    return out + v.size() * sizeof(T);
+}
+
+}
+
+const uint32_t BasicBlockList::MAGIC;
+const uint32_t BasicBlockList::VERSION;
+const uint32_t BasicBlockList::NO_BLOCK;
+
+BasicBlockList::BasicBlockList()
+{
+    m_starts = m_ends = NULL;
+    m_functions = m_functionNames = NULL;
+    m_blockCount = m_functionCount = 0;
+    m_strings = NULL;
+    m_stringsSize = 0;
+    m_overlaps = NULL;
+    m_overlapCount = 0;
+}
+
+bool BasicBlockList::load(const std::string &listFile)
+{
+    struct stat listStat;
+    if (stat(listFile.c_str(), &listStat) != 0) {
+        return false;
+    }
+
+    uint64_t listSize = listStat.st_size;
+    uint64_t listTime = listStat.st_mtime;
+
+    std::string cacheFile = getCacheFileName(listFile);
+    if (!llvm::MemoryBuffer::getFile(cacheFile.c_str(), m_buffer)) {
+        if (setImage(m_buffer->getBufferStart(), m_buffer->getBufferSize(), listSize, listTime)) {
+            return true;
+        }
+        m_buffer.reset();
+    }
+
+    return parse(listFile, listSize, listTime);
+}
+
+//Reads the text file and writes the cache. Blocks that overlap an earlier
+//block of the file are not loaded.
+bool BasicBlockList::parse(const std::string &listFile, uint64_t listSize, uint64_t listTime)
+{
+    FILE *fp = fopen(listFile.c_str(), "r");
+    if (!fp) {
+        return false;
+    }
+
+    std::set<ParsedBlock, ParsedBlock> blocks;
+    std::vector<Overlap> overlaps;
+    FunctionIds functionIds;
+
+    char buffer[1024];
+    char name[1024];
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        ParsedBlock bb;
+        name[0] = 0;
+        if (sscanf(buffer, "0x%"PRIx64" 0x%"PRIx64" %[^\r\t\n]", &bb.start, &bb.end, name) < 2 ||
+            bb.start > bb.end) {
+            continue;
+        }
+
+        bb.function = functionIds.end();
+        std::pair<std::set<ParsedBlock, ParsedBlock>::iterator, bool> result = blocks.insert(bb);
+        if (!result.second) {
+            Overlap o;
+            o.start = bb.start;
+            o.end = bb.end;
+            o.existingStart = (*result.first).start;
+            overlaps.push_back(o);
+            continue;
+        }
+
+        (*result.first).function = functionIds.insert(std::make_pair(std::string(name), 0)).first;
+    }
+
+    fclose(fp);
+
+    std::vector<uint32_t> nameOffsets;
+    std::string strings;
+    FunctionIds::iterator fit;
+    for (fit = functionIds.begin(); fit != functionIds.end(); ++fit) {
+        (*fit).second = nameOffsets.size();
+        nameOffsets.push_back(strings.size());
+        strings.append((*fit).first.c_str(), (*fit).first.size() + 1);
+    }
+
+    std::vector<uint64_t> starts, ends;
+    std::vector<uint32_t> functions;
+    std::set<ParsedBlock, ParsedBlock>::const_iterator bit;
+    for (bit = blocks.begin(); bit != blocks.end(); ++bit) {
+        starts.push_back((*bit).start);
+        ends.push_back((*bit).end);
+        functions.push_back((*(*bit).function).second);
+    }
+
+    BasicBlockListHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MAGIC;
+    hdr.version = VERSION;
+    hdr.listSize = listSize;
+    hdr.listTime = listTime;
+    hdr.blockCount = starts.size();
+    hdr.overlapCount = overlaps.size();
+    hdr.functionCount = nameOffsets.size();
+    hdr.stringsSize = strings.size();
+
+    m_image.resize(sizeof(hdr) + starts.size() * 2 * sizeof(uint64_t) +
+                   overlaps.size() * sizeof(Overlap) +
+                   (functions.size() + nameOffsets.size()) * sizeof(uint32_t) +
+                   strings.size());
+
+    char *out = &m_image[0];
+    memcpy(out, &hdr, sizeof(hdr));
+    out = copyArray(out + sizeof(hdr), starts);
+    out = copyArray(out, ends);
+    out = copyArray(out, overlaps);
+    out = copyArray(out, functions);
+    out = copyArray(out, nameOffsets);
+    memcpy(out, strings.data(), strings.size());
+
+    //Other tool runs may be reading the cache. It is only an optimization,
+    //failing to write it is not an error.
+    std::string cacheFile = getCacheFileName(listFile);
+    std::string tmpFile = getTemporaryFileName(cacheFile);
+    fp = fopen(tmpFile.c_str(), "wb");
+    if (fp) {
+        bool ok = fwrite(&m_image[0], m_image.size(), 1, fp) == 1;
+        ok = (fclose(fp) == 0) && ok;
+        if (!ok || rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+            remove(tmpFile.c_str());
+        }
+    }
+
+    return setImage(&m_image[0], m_image.size(), listSize, listTime);
+}
+
+//Points the accessors to the arrays of the image, after checking
+//that it is consistent and that it was built from the current list
+bool BasicBlockList::setImage(const char *data, uint64_t size, uint64_t listSize, uint64_t listTime)
+{
+    BasicBlockListHeader hdr;
+    if (size < sizeof(hdr)) {
+        return false;
+    }
+
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.magic != MAGIC || hdr.version != VERSION ||
+        hdr.listSize != listSize || hdr.listTime != listTime) {
+        return false;
+    }
+
+    uint64_t expected = sizeof(hdr) + (uint64_t)hdr.blockCount * 2 * sizeof(uint64_t) +
+                        (uint64_t)hdr.overlapCount * sizeof(Overlap) +
+                        ((uint64_t)hdr.blockCount + hdr.functionCount) * sizeof(uint32_t) +
+                        hdr.stringsSize;
+    if (expected != size) {
+        return false;
+    }
+
+    //Strings must be null-terminated
+    if (hdr.stringsSize > 0 && data[size - 1] != 0) {
+        return false;
+    }
+
+    const char *p = data + sizeof(hdr);
+    m_starts = (const uint64_t*)p;
+    p += hdr.blockCount * sizeof(uint64_t);
+    m_ends = (const uint64_t*)p;
+    p += hdr.blockCount * sizeof(uint64_t);
+    m_overlaps = (const Overlap*)p;
+    p += hdr.overlapCount * sizeof(Overlap);
+    m_functions = (const uint32_t*)p;
+    p += hdr.blockCount * sizeof(uint32_t);
+    m_functionNames = (const uint32_t*)p;
+    p += hdr.functionCount * sizeof(uint32_t);
+    m_strings = p;
+
+    m_blockCount = hdr.blockCount;
+    m_overlapCount = hdr.overlapCount;
+    m_functionCount = hdr.functionCount;
+    m_stringsSize = hdr.stringsSize;
+
+    if (!validate()) {
+        m_blockCount = m_overlapCount = m_functionCount = m_stringsSize = 0;
+        return false;
+    }
+
+    return true;
+}
+
+//Checks that the blocks are sorted and disjoint and that all the ids and
+//offsets are in range, so that a stale or corrupted cache cannot make the
+//users of the list access memory outside of it
+bool BasicBlockList::validate() const
+{
+    for (uint32_t i = 0; i < m_blockCount; ++i) {
+        if (m_starts[i] > m_ends[i] || m_functions[i] >= m_functionCount) {
+            return false;
+        }
+        if (i > 0 && m_starts[i] <= m_ends[i - 1]) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < m_functionCount; ++i) {
+        if (m_functionNames[i] >= m_stringsSize) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const char *BasicBlockList::getFunctionName(uint32_t function) const
+{
+    if (function >= m_functionCount || m_functionNames[function] >= m_stringsSize) {
+        return "";
+    }
+    return m_strings + m_functionNames[function];
+}
+
+uint32_t BasicBlockList::find(uint64_t address) const
+{
+    //First block that starts after the address
+    uint32_t low = 0, high = m_blockCount;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (m_starts[mid] <= address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == 0 || m_ends[low - 1] < address) {
+        return NO_BLOCK;
+    }
+
+    return low - 1;
+}
+
+}
@@ -0,0 +1,143 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_BASICBLOCKLIST_H
+#define S2ETOOLS_BASICBLOCKLIST_H
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/ADT/OwningPtr.h>
+
+namespace s2etools
+{
+
+/**
+ *  Basic blocks of a module, as listed in its .bblist file. Each line of
+ *  the file has the start and (inclusive) end addresses of a block,
+ *  followed by the name of its function.
+ *
+ *  The parsed list is cached next to the text file (<list>.cache) in a
+ *  form that is used in place once mapped: the blocks sorted by address
+ *  and a table of the function names. Later loads check that the text
+ *  file did not change since the cache was written, and that the cache
+ *  is consistent. The list is parsed again otherwise.
+ */
+class BasicBlockList
+{
+public:
+    static const uint32_t MAGIC = 0x4c424253; //"SBBL"
+    static const uint32_t VERSION = 1;
+    static const uint32_t NO_BLOCK = 0xffffffff;
+
+    //Block that was not loaded because it overlaps
+    //the one at existingStart, which comes first in the file
+    struct Overlap {
+        uint64_t start;
+        uint64_t end;
+        uint64_t existingStart;
+    };
+
+private:
+    //Used when the cache could not be read
+    std::vector<char> m_image;
+    llvm::OwningPtr<llvm::MemoryBuffer> m_buffer;
+
+    const uint64_t *m_starts;
+    const uint64_t *m_ends;
+    const uint32_t *m_functions;
+    uint32_t m_blockCount;
+
+    const uint32_t *m_functionNames;
+    uint32_t m_functionCount;
+    const char *m_strings;
+    uint32_t m_stringsSize;
+
+    const Overlap *m_overlaps;
+    uint32_t m_overlapCount;
+
+    bool parse(const std::string &listFile, uint64_t fileSize, uint64_t fileTime);
+    bool setImage(const char *data, uint64_t size, uint64_t fileSize, uint64_t fileTime);
+    bool validate() const;
+
+public:
+    BasicBlockList();
+
+    bool load(const std::string &listFile);
+
+    uint32_t getBlockCount() const {
+        return m_blockCount;
+    }
+
+    uint64_t getStart(uint32_t block) const {
+        return m_starts[block];
+    }
+
+    uint64_t getEnd(uint32_t block) const {
+        return m_ends[block];
+    }
+
+    //Function ids are sorted by name
+    uint32_t getFunction(uint32_t block) const {
+        return m_functions[block];
+    }
+
+    uint32_t getFunctionCount() const {
+        return m_functionCount;
+    }
+
+    const char *getFunctionName(uint32_t function) const;
+
+    uint32_t getOverlapCount() const {
+        return m_overlapCount;
+    }
+
+    const Overlap &getOverlap(uint32_t i) const {
+        return m_overlaps[i];
+    }
+
+    //Returns the block that contains the address, or NO_BLOCK
+    uint32_t find(uint64_t address) const;
+
+    static std::string getCacheFileName(const std::string &listFile) {
+        return listFile + ".cache";
+    }
+};
+
+}
+
+#endif
@@ -35,51 +35,27 @@
 #define __STDC_FORMAT_MACROS 1
 
 
-#include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <stdio.h>
 #include <inttypes.h>
 #include "BasicBlockListParser.h"
 
 namespace s2etools
 {
 
-bool BasicBlockListParser::parseListing(llvm::sys::Path &listingFile, BasicBlocks &blocks)
+bool BasicBlockListParser::parseListing(llvm::sys::Path &listingFile, BasicBlockList &list)
 {
-    std::filebuf file;
-    if (!file.open(listingFile.c_str(), std::ios::in)) {
+    if (!list.load(listingFile.str())) {
         return false;
     }
 
-    std::istream is(&file);
-
-    char line[1024];
-    bool hasErrors = false;
-    while(is.getline(line, sizeof(line))) {
-        //Grab the start and the end
-        uint64_t start, end;
-        sscanf(line, "0x%"PRIx64" 0x%"PRIx64"", &start, &end);
-
-        //Grab the function name
-        std::string fcnName = line;
-        fcnName.erase(fcnName.find_last_not_of(" \n\r\t")+1);
-        fcnName.erase(0, fcnName.find_last_of(" \t")+1);
-
-        BasicBlock bb(start, end-start+1);
-        if (blocks.find(bb) != blocks.end()) {
-            std::cerr << "BasicBlockListParser: bb start=0x" << std::hex
-                      << bb.start << " size=0x" << bb.size << " overlaps an existing block"<< std::endl;
-            hasErrors = true;
-            continue;
-        }
-
-        bb.function = fcnName;
-
-        blocks.insert(bb);
+    for (uint32_t i = 0; i < list.getOverlapCount(); ++i) {
+        const BasicBlockList::Overlap &o = list.getOverlap(i);
+        std::cerr << "BasicBlockListParser: bb start=0x" << std::hex
+                  << o.start << " size=0x" << o.end - o.start + 1 << " overlaps an existing block"<< std::endl;
     }
 
-    return !hasErrors;
+    return list.getOverlapCount() == 0;
 }
 
 }
@@ -37,6 +37,9 @@
 #define S2ETOOLS_BBLP_H
 
 #include <llvm/Support/Path.h>
+#include <set>
+#include <string>
+#include "BasicBlockList.h"
 
 namespace s2etools
 {
@@ -77,7 +80,8 @@ class BasicBlockListParser {
 public:
     typedef std::set<BasicBlock, BasicBlock> BasicBlocks;
 
-    static bool parseListing(llvm::sys::Path &listing, BasicBlocks &blocks);
+    //Reports the overlapping blocks of the list as errors
+    static bool parseListing(llvm::sys::Path &listing, BasicBlockList &list);
 
 };
 
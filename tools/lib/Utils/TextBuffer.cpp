@@ -0,0 +1,98 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+#include "TextBuffer.h"
+
+namespace s2etools
+{
+
+const unsigned TextBuffer::FLUSH_SIZE;
+
+TextBuffer::TextBuffer()
+{
+    m_os = NULL;
+}
+
+TextBuffer::TextBuffer(std::ostream &os)
+{
+    m_os = &os;
+    m_buffer.reserve(FLUSH_SIZE + 256);
+}
+
+TextBuffer::~TextBuffer()
+{
+    flush();
+}
+
+void TextBuffer::append(const TextNumber &n)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    //Enough for 64-bit numbers in base 10
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+
+    uint64_t value = n.value;
+    if (n.base == 16) {
+        do {
+            *--p = digits[value & 0xf];
+            value >>= 4;
+        } while (value);
+    } else {
+        do {
+            *--p = digits[value % 10];
+            value /= 10;
+        } while (value);
+    }
+
+    unsigned length = end - p;
+    if (n.width > length) {
+        m_buffer.append(n.width - length, n.fill);
+    }
+
+    m_buffer.append(p, length);
+}
+
+void TextBuffer::flush()
+{
+    if (!m_os || m_buffer.empty()) {
+        return;
+    }
+
+    m_os->write(m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+}
+
+}
@@ -0,0 +1,130 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+#ifndef S2ETOOLS_TEXTBUFFER_H
+#define S2ETOOLS_TEXTBUFFER_H
+
+#include <ostream>
+#include <string>
+#include <inttypes.h>
+
+namespace s2etools
+{
+
+//Unsigned number printed by a TextBuffer, like an ostream with
+//std::hex or std::dec, std::setw(width) and std::setfill(fill)
+struct TextNumber
+{
+    uint64_t value;
+    unsigned base;
+    unsigned width;
+    char fill;
+};
+
+inline TextNumber hexNumber(uint64_t value, unsigned width = 0, char fill = ' ')
+{
+    TextNumber n = {value, 16, width, fill};
+    return n;
+}
+
+inline TextNumber decNumber(uint64_t value, unsigned width = 0, char fill = ' ')
+{
+    TextNumber n = {value, 10, width, fill};
+    return n;
+}
+
+/**
+ *  Text output for the trace printers. Numbers are formatted without
+ *  allocating memory and without stream state: the base and the padding
+ *  are given for each number. The text is appended to a large buffer,
+ *  which is written to the output stream when it is full, or kept in
+ *  memory when there is no output stream.
+ */
+class TextBuffer
+{
+private:
+    std::string m_buffer;
+    std::ostream *m_os;
+
+    void append(const TextNumber &n);
+
+    void checkFlush() {
+        if (m_os && m_buffer.size() >= FLUSH_SIZE) {
+            flush();
+        }
+    }
+
+public:
+    static const unsigned FLUSH_SIZE = 64 * 1024;
+
+    TextBuffer();
+    TextBuffer(std::ostream &os);
+    ~TextBuffer();
+
+    TextBuffer &operator<<(const char *s) {
+        m_buffer.append(s);
+        checkFlush();
+        return *this;
+    }
+
+    TextBuffer &operator<<(const std::string &s) {
+        m_buffer.append(s);
+        checkFlush();
+        return *this;
+    }
+
+    TextBuffer &operator<<(char c) {
+        m_buffer.push_back(c);
+        checkFlush();
+        return *this;
+    }
+
+    TextBuffer &operator<<(const TextNumber &n) {
+        append(n);
+        checkFlush();
+        return *this;
+    }
+
+    //Writes the buffered text to the output stream
+    void flush();
+
+    //Text kept in memory when there is no output stream
+    std::string &str() {
+        return m_buffer;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <cassert>
+#include "ThreadPool.h"
+
+#include "llvm/Support/CommandLine.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace {
+    llvm::cl::opt<unsigned>
+            ThreadCount("threads",
+                        llvm::cl::desc("Number of worker threads (0 uses one thread per processor)"),
+                        llvm::cl::init(0));
+}
+
+namespace s2etools
+{
+
+unsigned ThreadPool::getDefaultThreadCount()
+{
+    if (ThreadCount > 0) {
+        return ThreadCount;
+    }
+
+#ifdef _WIN32
+    return 1;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (unsigned) cpus : 1;
+#endif
+}
+
+#ifdef _WIN32
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    m_pending = 0;
+    m_threadCount = 1;
+    m_stopping = false;
+}
+
+ThreadPool::~ThreadPool()
+{
+
+}
+
+void ThreadPool::submit(ThreadPoolTask *task)
+{
+    task->run();
+}
+
+void ThreadPool::wait()
+{
+
+}
+
+#else
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    m_pending = 0;
+    m_stopping = false;
+    m_threadCount = threadCount ? threadCount : getDefaultThreadCount();
+
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_taskAvailable, NULL);
+    pthread_cond_init(&m_allDone, NULL);
+
+    for (unsigned i = 0; i < m_threadCount; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, workerMain, this)) {
+            break;
+        }
+        m_threads.push_back(thread);
+    }
+
+    //submit() falls back to running the tasks itself
+    m_threadCount = m_threads.size();
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+
+    pthread_mutex_lock(&m_lock);
+    m_stopping = true;
+    pthread_cond_broadcast(&m_taskAvailable);
+    pthread_mutex_unlock(&m_lock);
+
+    std::vector<pthread_t>::iterator it;
+    for (it = m_threads.begin(); it != m_threads.end(); ++it) {
+        pthread_join(*it, NULL);
+    }
+
+    pthread_cond_destroy(&m_allDone);
+    pthread_cond_destroy(&m_taskAvailable);
+    pthread_mutex_destroy(&m_lock);
+}
+
+void *ThreadPool::workerMain(void *pool)
+{
+    static_cast<ThreadPool*>(pool)->worker();
+    return NULL;
+}
+
+void ThreadPool::worker()
+{
+    pthread_mutex_lock(&m_lock);
+    while (true) {
+        while (m_tasks.empty() && !m_stopping) {
+            pthread_cond_wait(&m_taskAvailable, &m_lock);
+        }
+
+        if (m_tasks.empty()) {
+            break;
+        }
+
+        ThreadPoolTask *task = m_tasks.front();
+        m_tasks.pop_front();
+        pthread_mutex_unlock(&m_lock);
+
+        task->run();
+
+        pthread_mutex_lock(&m_lock);
+        assert(m_pending > 0);
+        if (--m_pending == 0) {
+            pthread_cond_broadcast(&m_allDone);
+        }
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void ThreadPool::submit(ThreadPoolTask *task)
+{
+    if (m_threads.empty()) {
+        task->run();
+        return;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_tasks.push_back(task);
+    ++m_pending;
+    pthread_cond_signal(&m_taskAvailable);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void ThreadPool::wait()
+{
+    pthread_mutex_lock(&m_lock);
+    while (m_pending > 0) {
+        pthread_cond_wait(&m_allDone, &m_lock);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+#endif
+
+}
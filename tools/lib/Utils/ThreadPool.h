@@ -0,0 +1,103 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_THREADPOOL_H
+#define S2ETOOLS_THREADPOOL_H
+
+#include <deque>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace s2etools
+{
+
+class ThreadPoolTask
+{
+public:
+    virtual ~ThreadPoolTask() {}
+    virtual void run() = 0;
+};
+
+/**
+ *  Fixed set of worker threads executing tasks in submission order.
+ *  Tasks are owned by the caller and must stay alive until they have
+ *  run. The pool does not touch a task after its run() method returned,
+ *  so tasks may delete themselves there. Tasks may submit other tasks.
+ *  On platforms without pthreads, tasks run synchronously in submit().
+ */
+class ThreadPool
+{
+private:
+    typedef std::deque<ThreadPoolTask*> Tasks;
+
+    Tasks m_tasks;
+    unsigned m_pending;
+    unsigned m_threadCount;
+    bool m_stopping;
+
+#ifndef _WIN32
+    std::vector<pthread_t> m_threads;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_taskAvailable;
+    pthread_cond_t m_allDone;
+
+    static void *workerMain(void *pool);
+    void worker();
+#endif
+
+public:
+    //0 uses the value of the -threads option
+    ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    void submit(ThreadPoolTask *task);
+
+    //Blocks until all the submitted tasks have completed
+    void wait();
+
+    unsigned getThreadCount() const {
+        return m_threadCount;
+    }
+
+    //Value of -threads, or the number of online processors if it is 0
+    static unsigned getDefaultThreadCount();
+};
+
+}
+
+#endif
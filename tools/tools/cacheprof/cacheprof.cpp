@@ -151,7 +151,12 @@ int main(int argc, char **argv)
     library.setPaths(ModPath);
 
     LogParser parser;
+    library.prefetchModules(&parser);
     PathBuilder pb(&parser);
+    if (!pb.canReplay()) {
+        return -1;
+    }
+
     parser.parse(TraceFiles);
 
     ModuleCache mc(&pb);
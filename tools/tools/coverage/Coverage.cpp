@@ -44,17 +44,22 @@
 #include <lib/ExecutionTracer/Path.h>
 #include <lib/ExecutionTracer/TestCase.h>
 #include <lib/BinaryReaders/BFDInterface.h>
+#include <lib/Utils/TemporaryFile.h>
+#include <lib/Utils/TextBuffer.h>
+#include <lib/Utils/ThreadPool.h>
 
 
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <ostream>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <inttypes.h>
 #include <iomanip>
+#include <algorithm>
 #include "Coverage.h"
 
 using namespace llvm;
@@ -77,55 +82,132 @@ ModDir("moddir", cl::desc("Directory containing binary modules, the basic block
 cl::opt<bool>
     Compact("compact", cl::desc("Do not display non-covered blocks"), cl::init(false));
 
+cl::opt<bool>
+    Streaming("streaming", cl::desc("Map translation blocks to basic blocks as they are read instead of storing them. "
+                                    "Memory usage does not depend on the trace, blocks get the time of their earliest execution"),
+              cl::init(false));
+
+cl::opt<unsigned>
+    TimeBucket("timeBucket", cl::desc("Width in seconds of the intervals of the coverage curve (*.timecurve). "
+                                       "The curve replaces the time of each block (*.timecov) unless -timeBlocks is set"),
+               cl::init(0));
+
+cl::opt<bool>
+    TimeBlocks("timeBlocks", cl::desc("Write the time of each covered block along with the coverage curve"),
+               cl::init(false));
+
+cl::list<std::string>
+    MergeFiles("merge", cl::desc("Coverage database (*.covdb) of a previous run to merge into the results, can be repeated"));
+
 
 //cl::opt<std::string>
 //    CovType("covtype", cl::desc("Coverage type"), cl::init("basicblock"));
 
+//On-disk layout of a coverage database. The header is followed by the
+//module name, the covered and entered bitmaps, and the time stamps.
+struct CoverageDatabaseHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t blockListHash;
+    uint64_t pathCount;
+    uint32_t blockCount;
+    uint32_t nameLength;
+};
+
+//Time stamp of the blocks that are not covered
+const uint64_t NO_TIME = (uint64_t)-1;
+
+bool readDatabaseHeader(FILE *fp, CoverageDatabaseHeader &hdr, std::string &moduleName)
+{
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1) {
+        return false;
+    }
+
+    if (hdr.magic != BasicBlockCoverage::DB_MAGIC || hdr.version != BasicBlockCoverage::DB_VERSION) {
+        return false;
+    }
+
+    std::vector<char> name(hdr.nameLength);
+    if (hdr.nameLength && fread(&name[0], hdr.nameLength, 1, fp) != 1) {
+        return false;
+    }
+
+    moduleName.assign(name.begin(), name.end());
+    return true;
+}
+
+//Modules without any covered block may come from a coverage database
+uint64_t percent(uint64_t count, uint64_t total)
+{
+    return total ? count * 100 / total : 0;
+}
 
 }
 
 namespace s2etools
 {
+const uint32_t BasicBlockCoverage::NO_BLOCK;
+const unsigned BasicBlockCoverage::PAGE_BITS;
+const uint32_t BasicBlockCoverage::DB_MAGIC;
+const uint32_t BasicBlockCoverage::DB_VERSION;
+
 BasicBlockCoverage::BasicBlockCoverage(const std::string &moduleDir,
            const std::string &moduleName)
 {
+    m_name = moduleName;
+    m_coveredCount = 0;
+    m_missingTbCount = 0;
+    m_mergedPathCount = 0;
+    m_firstPage = 0;
+    m_functionStarts.push_back(0);
+    m_firstTime = m_lastTime = 0;
+    m_timeBucket = (uint64_t)TimeBucket * 1000000;
+
     llvm::sys::Path basicBlockListFile(moduleDir);
     basicBlockListFile.appendComponent(moduleName + ".bblist");
 
-    FILE *fp = fopen(basicBlockListFile.str().c_str(), "r");
-    if (!fp) {
+    if (!m_list.load(basicBlockListFile.str())) {
         std::cerr << "Could not open file " << basicBlockListFile.str() << std::endl;
         return;
     }
 
-    char buffer[512];
-    while (fgets(buffer, sizeof(buffer), fp)) {
-        uint64_t start, end;
-        char name[512];
-        sscanf(buffer, "0x%"PRIx64" 0x%"PRIx64" %[^\r\t\n]s", &start, &end, name);
-        //std::cout << "Read 0x" << std::hex << start << " 0x" << end << " " << name << std::endl;
-
-        unsigned prevCount = m_allBbs.size();
-        std::pair<BasicBlocks::iterator, bool> result = m_allBbs.insert(BasicBlock(start, end));
-        if (!result.second) {
-           std::cout << "Won't insert this block : existing block: " << (*result.first).start << std::endl;
-           continue;
-        }
+    for (uint32_t i = 0; i < m_list.getOverlapCount(); ++i) {
+        std::cout << "Won't insert this block : existing block: " << m_list.getOverlap(i).existingStart << std::endl;
+    }
+
+    //The list is sorted by address and free of overlaps
+    unsigned blockCount = m_list.getBlockCount();
+    m_allBbs.reserve(blockCount);
+    m_blockFunctions.resize(blockCount);
+    m_functionStarts.assign(m_list.getFunctionCount() + 1, 0);
+    for (unsigned i = 0; i < blockCount; ++i) {
+        m_allBbs.push_back(BasicBlock(m_list.getStart(i), m_list.getEnd(i)));
+        m_blockFunctions[i] = m_list.getFunction(i);
+        ++m_functionStarts[m_blockFunctions[i] + 1];
+    }
+
+    for (unsigned i = 1; i < m_functionStarts.size(); ++i) {
+        m_functionStarts[i] += m_functionStarts[i - 1];
+    }
 
-        BasicBlocks &bbs = m_functions[name];
-        //XXX: the +1 is here to compensate the broken extraction script, which
-        //does not take into account the whole size of the last instruction.
-        prevCount = bbs.size();
-        bbs.insert(BasicBlock(start, end));
-        assert(prevCount == bbs.size()-1);
+    //Distribute the blocks to their functions in address order
+    BlockIds next(m_functionStarts.begin(), m_functionStarts.end() - 1);
+    m_functionBlocks.resize(blockCount);
+    for (unsigned i = 0; i < blockCount; ++i) {
+        m_functionBlocks[next[m_blockFunctions[i]]++] = i;
     }
 
-    Functions::iterator fit;
-    unsigned fcnBbCount = 0;
-    for (fit = m_functions.begin(); fit != m_functions.end() ; ++fit) {
-        fcnBbCount += (*fit).second.size();
+    m_coveredBbs.resize((m_allBbs.size() + 31) / 32);
+    m_enteredBbs.resize(m_coveredBbs.size());
+
+    if (!m_allBbs.empty()) {
+        uint64_t first = m_allBbs.front().start;
+        uint64_t last = m_allBbs.back().end;
+
+        //Conversions map the byte preceding a block to that block
+        m_firstPage = (first ? first - 1 : first) >> PAGE_BITS;
+        m_pageTable.resize((last >> PAGE_BITS) - m_firstPage + 1);
     }
-    assert(fcnBbCount == m_allBbs.size());
 
     if (m_allBbs.size() == 0) {
         std::cerr << "No basic blocks found in the list for " << moduleName << ". Check the format of the file." << std::endl;
@@ -156,76 +238,355 @@ void BasicBlockCoverage::parseExcludeFile(const std::string &moduleDir,
     fclose(fp);
 }
 
-//Start and end must be local to the model
-bool BasicBlockCoverage::addTranslationBlock(uint64_t ts, uint64_t start, uint64_t end)
+static void insertTranslationBlock(BasicBlockCoverage::Blocks &tbs, const Block &tb)
 {
-    Block tb(ts, start, end);
-    Blocks::iterator it = m_uniqueTbs.find(tb);
+    BasicBlockCoverage::Blocks::iterator it = tbs.find(tb);
 
-    if (it == m_uniqueTbs.end()) {
-        m_uniqueTbs.insert(tb);
-        return true;
+    if (it == tbs.end()) {
+        tbs.insert(tb);
     }else {
-        if ((*it).timeStamp > ts) {
-            m_uniqueTbs.erase(*it);
-            m_uniqueTbs.insert(tb);
-            return true;
+        if ((*it).timeStamp > tb.timeStamp) {
+            tbs.erase(it);
+            tbs.insert(tb);
+        }
+    }
+}
+
+//Start and end must be local to the model
+void BasicBlockCoverage::addTranslationBlock(uint64_t ts, uint64_t start, uint64_t end)
+{
+    insertTranslationBlock(m_uniqueTbs, Block(ts, start, end));
+}
+
+void BasicBlockCoverage::initPartial(PartialCoverage &partial) const
+{
+    partial.times.assign(m_allBbs.size(), NO_TIME);
+    partial.entered.assign(m_enteredBbs.size(), 0);
+}
+
+void BasicBlockCoverage::addTranslationBlock(PartialCoverage &partial, uint64_t ts,
+                                             uint64_t start, uint64_t end) const
+{
+    insertTranslationBlock(partial.tbs, Block(ts, start, end));
+}
+
+void BasicBlockCoverage::coverTranslationBlock(PartialCoverage &partial, uint64_t ts,
+                                               uint64_t start, uint64_t end) const
+{
+    bool missing = false;
+
+    uint32_t id = findBlockId(start);
+    if (id != NO_BLOCK && m_allBbs[id].start == start) {
+        partial.entered[id / 32] |= 1u << (id % 32);
+    }
+
+    uint64_t s = start;
+    while (s < end) {
+        id = findBlockId(s);
+        if (id == NO_BLOCK) {
+            missing = true;
+            ++s;
+            continue;
+        }
+
+        if (ts < partial.times[id]) {
+            partial.times[id] = ts;
         }
+
+        s = m_allBbs[id].end + 1;
     }
 
-    return false;
+    if (missing) {
+        ++partial.missingTbCount;
+    }
 }
 
-void BasicBlockCoverage::convertTbToBb()
+//Blocks covered by several threads keep the earliest time stamp
+void BasicBlockCoverage::mergePartial(const PartialCoverage &partial)
+{
+    Blocks::const_iterator it;
+    for (it = partial.tbs.begin(); it != partial.tbs.end(); ++it) {
+        insertTranslationBlock(m_uniqueTbs, *it);
+    }
+
+    for (unsigned i = 0; i < partial.times.size(); ++i) {
+        if (partial.times[i] == NO_TIME) {
+            continue;
+        }
+
+        if (!isCovered(i)) {
+            setCovered(i, partial.times[i]);
+        } else {
+            lowerTime(i, partial.times[i]);
+        }
+    }
+
+    for (unsigned i = 0; i < partial.entered.size(); ++i) {
+        m_enteredBbs[i] |= partial.entered[i];
+    }
+
+    m_missingTbCount += partial.missingTbCount;
+}
+
+struct BlockEndsBefore {
+    bool operator()(const BasicBlock &b, uint64_t address) const {
+        return b.end < address;
+    }
+};
+
+//Fills the block ids of the addresses of a page. An address belongs to
+//the first block that ends at or after it, if that block starts at most
+//one byte later.
+void BasicBlockCoverage::buildPage(BlockIds &page, uint64_t pageStart) const
+{
+    page.resize(1 << PAGE_BITS);
+
+    BasicBlockArray::const_iterator it = std::lower_bound(m_allBbs.begin(), m_allBbs.end(),
+                                                          pageStart, BlockEndsBefore());
+    for (unsigned i = 0; i < page.size(); ++i) {
+        uint64_t address = pageStart + i;
+        while (it != m_allBbs.end() && (*it).end < address) {
+            ++it;
+        }
+
+        if (it != m_allBbs.end() && (*it).start <= address + 1) {
+            page[i] = it - m_allBbs.begin();
+        } else {
+            page[i] = NO_BLOCK;
+        }
+    }
+}
+
+//Same as getBlockId, without the page table. Does not modify the
+//coverage and may be called by several threads at once.
+uint32_t BasicBlockCoverage::findBlockId(uint64_t address) const
+{
+    BasicBlockArray::const_iterator it = std::lower_bound(m_allBbs.begin(), m_allBbs.end(),
+                                                          address, BlockEndsBefore());
+    if (it != m_allBbs.end() && (*it).start <= address + 1) {
+        return it - m_allBbs.begin();
+    }
+
+    return NO_BLOCK;
+}
+
+uint32_t BasicBlockCoverage::getBlockId(uint64_t address)
+{
+    uint64_t pageNum = address >> PAGE_BITS;
+    if (pageNum < m_firstPage || pageNum - m_firstPage >= m_pageTable.size()) {
+        return NO_BLOCK;
+    }
+
+    BlockIds &page = m_pageTable[pageNum - m_firstPage];
+    if (page.empty()) {
+        buildPage(page, pageNum << PAGE_BITS);
+    }
+
+    return page[address & ((1 << PAGE_BITS) - 1)];
+}
+
+void BasicBlockCoverage::convertTbToBb(std::ostream &errors)
 {
-    BasicBlocks::iterator it;
     Blocks::iterator tbit;
 
     for(tbit = m_uniqueTbs.begin(); tbit != m_uniqueTbs.end(); ++tbit) {
         const Block &tb = *tbit;
-
-        for (uint64_t s = tb.start; s < tb.end; s++) {
-
-            BasicBlock tbb(s, s+1);
-            it = m_allBbs.find(tbb);
-            if(it == m_allBbs.end()) {
-                std::cerr << "Missing TB: " << std::hex << "0x"
+        setEntered(tb.start);
+
+        //Visit each block of the TB once instead of each byte
+        uint64_t s = tb.start;
+        while (s < tb.end) {
+            uint32_t id = getBlockId(s);
+            if (id == NO_BLOCK) {
+                errors << "Missing TB: " << std::hex << "0x"
                     << tb.start << ":0x" << tb.end << std::endl;
+                ++s;
                 continue;
             }
-            //assert(it != m_allBbs.end());
 
-            BasicBlock newBlock;
-            newBlock.timeStamp = tb.timeStamp;
-            newBlock.start = (*it).start;
-            newBlock.end = (*it).end;
-
-            if (m_coveredBbs.find(newBlock) == m_coveredBbs.end()) {
-                    m_coveredBbs.insert(newBlock);
+            if (!isCovered(id)) {
+                setCovered(id, tb.timeStamp);
             }
 
+            s = m_allBbs[id].end + 1;
+        }
+
+    }
+
+    //The TBs are not needed anymore
+    m_uniqueTbs.clear();
+}
+
+//Identifies the basic block list, databases can only be merged
+//if they were built from the same list (FNV-1a)
+uint64_t BasicBlockCoverage::getBlockListHash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned i = 0; i < m_allBbs.size(); ++i) {
+        uint64_t bounds[2] = {m_allBbs[i].start, m_allBbs[i].end};
+        const uint8_t *bytes = (const uint8_t*)bounds;
+        for (unsigned j = 0; j < sizeof(bounds); ++j) {
+            hash ^= bytes[j];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+bool BasicBlockCoverage::saveDatabase(const std::string &fileName, uint64_t pathCount) const
+{
+    //The database replaces the previous one only once it is complete.
+    //A run that dies while writing it, or another run writing the same
+    //database, must not leave a truncated file for the -merge runs.
+    std::string tmpFile = getTemporaryFileName(fileName);
+    FILE *fp = fopen(tmpFile.c_str(), "wb");
+    if (!fp) {
+        std::cerr << "Could not open file " << tmpFile << std::endl;
+        return false;
+    }
+
+    CoverageDatabaseHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DB_MAGIC;
+    hdr.version = DB_VERSION;
+    hdr.blockListHash = getBlockListHash();
+    hdr.pathCount = pathCount;
+    hdr.blockCount = m_allBbs.size();
+    hdr.nameLength = m_name.size();
+
+    std::vector<uint64_t> times(m_allBbs.size());
+    for (unsigned i = 0; i < m_allBbs.size(); ++i) {
+        times[i] = isCovered(i) ? m_allBbs[i].timeStamp : NO_TIME;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    ok = ok && fwrite(m_name.data(), 1, m_name.size(), fp) == m_name.size();
+    if (ok && !times.empty()) {
+        ok = fwrite(&m_coveredBbs[0], sizeof(uint32_t), m_coveredBbs.size(), fp) == m_coveredBbs.size() &&
+             fwrite(&m_enteredBbs[0], sizeof(uint32_t), m_enteredBbs.size(), fp) == m_enteredBbs.size() &&
+             fwrite(&times[0], sizeof(uint64_t), times.size(), fp) == times.size();
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpFile.c_str(), fileName.c_str()) != 0) {
+        std::cerr << "Could not write " << fileName << std::endl;
+        remove(tmpFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool BasicBlockCoverage::getDatabaseModule(const std::string &fileName, std::string &moduleName)
+{
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    CoverageDatabaseHeader hdr;
+    bool ok = readDatabaseHeader(fp, hdr, moduleName);
+    fclose(fp);
+    return ok;
+}
+
+//Covered blocks are the union of both runs, each block keeps
+//its earliest time stamp
+bool BasicBlockCoverage::mergeDatabase(const std::string &fileName)
+{
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (!fp) {
+        std::cerr << "Could not open file " << fileName << std::endl;
+        return false;
+    }
+
+    CoverageDatabaseHeader hdr;
+    std::string moduleName;
+    bool ok = readDatabaseHeader(fp, hdr, moduleName);
+    if (!ok || moduleName != m_name || hdr.blockCount != m_allBbs.size() ||
+        hdr.blockListHash != getBlockListHash()) {
+        std::cerr << fileName << " is not a coverage database of the current basic block list of "
+                  << m_name << std::endl;
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<uint32_t> covered(m_coveredBbs.size()), entered(m_enteredBbs.size());
+    std::vector<uint64_t> times(m_allBbs.size());
+    if (!times.empty()) {
+        ok = fread(&covered[0], sizeof(uint32_t), covered.size(), fp) == covered.size() &&
+             fread(&entered[0], sizeof(uint32_t), entered.size(), fp) == entered.size() &&
+             fread(&times[0], sizeof(uint64_t), times.size(), fp) == times.size();
+    }
+    fclose(fp);
+
+    if (!ok) {
+        std::cerr << "Could not read " << fileName << std::endl;
+        return false;
+    }
+
+    for (unsigned i = 0; i < m_allBbs.size(); ++i) {
+        if (!(covered[i / 32] & (1u << (i % 32)))) {
+            continue;
         }
 
+        if (!isCovered(i)) {
+            setCovered(i, times[i]);
+        } else {
+            lowerTime(i, times[i]);
+        }
+    }
+
+    for (unsigned i = 0; i < m_enteredBbs.size(); ++i) {
+        m_enteredBbs[i] |= entered[i];
     }
 
+    m_mergedPathCount += hdr.pathCount;
+    return true;
 }
 
+void BasicBlockCoverage::summarize(bool sortByTime)
+{
+    std::vector<unsigned> coveredCounts(getFunctionCount());
+
+    m_blocksByTime.clear();
+    m_firstTime = NO_TIME;
+    m_lastTime = 0;
+    for (unsigned i = 0; i < m_allBbs.size(); ++i) {
+        if (isCovered(i)) {
+            ++coveredCounts[m_blockFunctions[i]];
+            m_firstTime = std::min(m_firstTime, m_allBbs[i].timeStamp);
+            m_lastTime = std::max(m_lastTime, m_allBbs[i].timeStamp);
+            if (sortByTime) {
+                m_blocksByTime.push_back(m_allBbs[i]);
+            }
+        }
+    }
+
+    std::sort(m_blocksByTime.begin(), m_blocksByTime.end(), BasicBlock::SortByTime());
+
+    m_summaries.clear();
+    m_summaries.reserve(getFunctionCount());
+
+    for (unsigned i = 0; i < getFunctionCount(); ++i) {
+        FunctionSummary summary;
+        summary.function = i;
+        summary.coveredCount = coveredCounts[i];
+        summary.ignored = !m_ignoredFunctions.empty() &&
+                          m_ignoredFunctions.find(getFunctionName(i)) != m_ignoredFunctions.end();
+        m_summaries.push_back(summary);
+    }
+}
 
 void BasicBlockCoverage::printTimeCoverage(std::ostream &os) const
 {
-    BlocksByTime bbtime;
-    BlocksByTime::const_iterator tit;
+    BasicBlockArray::const_iterator tit;
 
     bool timeInited = false;
     uint64_t firstTime = 0;
 
-    BasicBlocks::const_iterator it;
-    for (it = m_coveredBbs.begin(); it != m_coveredBbs.end(); ++it) {
-        bbtime.insert(*it);
-    }
-
     unsigned i = 0;
-    for (tit = bbtime.begin(); tit != bbtime.end(); ++tit) {
+    for (tit = m_blocksByTime.begin(); tit != m_blocksByTime.end(); ++tit) {
         const BasicBlock &b = *tit;
 
         if (!timeInited) {
@@ -241,22 +602,34 @@ void BasicBlockCoverage::printTimeCoverage(std::ostream &os) const
     }
 }
 
-//Returns the time in seconds of the last covered block
-uint64_t BasicBlockCoverage::getTimeCoverage() const
+//Each line has the time in seconds of the start of the interval, relative
+//to the interval of the first covered block, followed by the number of
+//blocks first covered in the interval and the cumulative count
+void BasicBlockCoverage::printTimeCurve(std::ostream &os) const
 {
-    BlocksByTime bbtime;
-    BlocksByTime::const_iterator tfirst;
-    BlocksByTime::const_reverse_iterator tit;
+    if (m_timeHistogram.empty()) {
+        return;
+    }
 
-    BasicBlocks::const_iterator it;
-    for (it = m_coveredBbs.begin(); it != m_coveredBbs.end(); ++it) {
-        bbtime.insert(*it);
+    uint64_t firstBucket = (*m_timeHistogram.begin()).first;
+    uint64_t cumulative = 0;
+
+    TimeHistogram::const_iterator it;
+    for (it = m_timeHistogram.begin(); it != m_timeHistogram.end(); ++it) {
+        cumulative += (*it).second;
+        os << std::dec << ((*it).first - firstBucket) * m_timeBucket / 1000000
+           << " " << (*it).second << " " << cumulative << std::endl;
     }
+}
 
-    tfirst = bbtime.begin();
-    tit = bbtime.rbegin();
+//Returns the time in seconds of the last covered block
+uint64_t BasicBlockCoverage::getTimeCoverage() const
+{
+    if (m_coveredCount == 0) {
+        return 0;
+    }
 
-    return ((*tit).timeStamp - (*tfirst).timeStamp)/1000000;
+    return (m_lastTime - m_firstTime)/1000000;
 }
 
 
@@ -268,59 +641,55 @@ void BasicBlockCoverage::printReport(std::ostream &os, uint64_t pathCount,
     unsigned touchedFunctionsBb = 0;
     unsigned touchedFunctionsTotalBb = 0;
     unsigned allFunctionsBb = 0;
-    Functions::const_iterator fit;
+    FunctionSummaries::const_iterator sit;
 
-    for(fit = m_functions.begin(); fit != m_functions.end(); ++fit) {
-        if (useIgnoreList) {
-            if (m_ignoredFunctions.find((*fit).first) != m_ignoredFunctions.end()) {
-                continue;
-            }
+    for(sit = m_summaries.begin(); sit != m_summaries.end(); ++sit) {
+        if (useIgnoreList && (*sit).ignored) {
+            continue;
         }
 
-        const BasicBlocks &fcnbb = (*fit).second;
-        BasicBlocks uncovered;
-        BasicBlocks::const_iterator bbit;
-        for (bbit = fcnbb.begin(); bbit != fcnbb.end(); ++bbit) {
-            if (m_coveredBbs.find(*bbit) == m_coveredBbs.end()) {
-                uncovered.insert(*bbit);
-            }
-        }
+        uint32_t function = (*sit).function;
+        unsigned blockCount = getFunctionEnd(function) - getFunctionBegin(function);
+        BlockIds::const_iterator bbit;
 
-        unsigned int coveredCount = (fcnbb.size() - uncovered.size());
+        unsigned int coveredCount = (*sit).coveredCount;
+        unsigned int uncoveredCount = blockCount - coveredCount;
         char line[512];
 
         if (csv) {
             snprintf(line, sizeof(line), "%u,%u,%u,%s,",
-                     (unsigned)(coveredCount*100/fcnbb.size()), coveredCount, (unsigned)fcnbb.size(),
-                     (*fit).first.c_str());
+                     coveredCount*100/blockCount, coveredCount, blockCount,
+                     getFunctionName(function));
         } else {
             snprintf(line, sizeof(line), "(%3u%%) %03u/%03u %-50s ",
-                     (unsigned)(coveredCount*100/fcnbb.size()), coveredCount, (unsigned)fcnbb.size(),
-                     (*fit).first.c_str());
+                     coveredCount*100/blockCount, coveredCount, blockCount,
+                     getFunctionName(function));
         }
 
         os << line;
 
-        if (uncovered.size() == fcnbb.size()) {
+        if (uncoveredCount == blockCount) {
             os << "The function was not exercised";
         }else {
-            if (uncovered.size() == 0) {
+            if (uncoveredCount == 0) {
                 os << "Full coverage";
                 fullyCoveredFunctions++;
             }else {
                 if (!Compact) {
                     char delim = csv ? ',' : ' ';
-                    for (bbit = uncovered.begin(); bbit != uncovered.end(); ++bbit) {
-                        os << std::hex << "0x" << (*bbit).start << delim;
+                    for (bbit = getFunctionBegin(function); bbit != getFunctionEnd(function); ++bbit) {
+                        if (!isCovered(*bbit)) {
+                            os << std::hex << "0x" << m_allBbs[*bbit].start << delim;
+                        }
                     }
                 }
             }
             touchedFunctionsBb += coveredCount;
-            touchedFunctionsTotalBb += fcnbb.size();
+            touchedFunctionsTotalBb += blockCount;
             touchedFunctions++;
         }
 
-        allFunctionsBb += fcnbb.size();
+        allFunctionsBb += blockCount;
 
         os << std::endl;
 
@@ -329,14 +698,14 @@ void BasicBlockCoverage::printReport(std::ostream &os, uint64_t pathCount,
 
     if (useIgnoreList) {
         os << "Basic block coverage:    " << std::dec << touchedFunctionsBb << "/" << allFunctionsBb <<
-                "(" << (touchedFunctionsBb*100/allFunctionsBb) << "%)"  << std::endl;
+                "(" << percent(touchedFunctionsBb, allFunctionsBb) << "%)"  << std::endl;
 
     } else {
-        os << "Basic block coverage:    " << std::dec << m_coveredBbs.size() << "/" << m_allBbs.size() <<
-                "(" << (m_coveredBbs.size()*100/m_allBbs.size()) << "%)"  << std::endl;
+        os << "Basic block coverage:    " << std::dec << m_coveredCount << "/" << m_allBbs.size() <<
+                "(" << percent(m_coveredCount, m_allBbs.size()) << "%)"  << std::endl;
 
         os << "Function block coverage: " << std::dec << touchedFunctionsBb << "/" << touchedFunctionsTotalBb <<
-                "(" << (touchedFunctionsBb*100/touchedFunctionsTotalBb) << "%)"  << std::endl;
+                "(" << percent(touchedFunctionsBb, touchedFunctionsTotalBb) << "%)"  << std::endl;
     }
 
 
@@ -344,13 +713,13 @@ void BasicBlockCoverage::printReport(std::ostream &os, uint64_t pathCount,
 
     if (useIgnoreList) {
         os << "Fully covered functions: " << std::dec << fullyCoveredFunctions << "/" << touchedFunctions <<
-                "(" << (fullyCoveredFunctions*100/touchedFunctions) << "%)"  << std::endl;
+                "(" << percent(fullyCoveredFunctions, touchedFunctions) << "%)"  << std::endl;
     } else {
-        os << "Total touched functions: " << std::dec << touchedFunctions << "/" << m_functions.size() <<
-                "(" << (touchedFunctions*100/m_functions.size()) << "%)"  << std::endl;
+        os << "Total touched functions: " << std::dec << touchedFunctions << "/" << getFunctionCount() <<
+                "(" << percent(touchedFunctions, getFunctionCount()) << "%)"  << std::endl;
 
-        os << "Fully covered functions: " << std::dec << fullyCoveredFunctions << "/" << m_functions.size() <<
-                "(" << (fullyCoveredFunctions*100/m_functions.size()) << "%)"  << std::endl;
+        os << "Fully covered functions: " << std::dec << fullyCoveredFunctions << "/" << getFunctionCount() <<
+                "(" << percent(fullyCoveredFunctions, getFunctionCount()) << "%)"  << std::endl;
     }
 
 
@@ -361,23 +730,23 @@ void BasicBlockCoverage::printReport(std::ostream &os, uint64_t pathCount,
 
 void BasicBlockCoverage::printBBCov(std::ostream &os) const
 {
-    Functions::const_iterator fit;
-
-    for(fit = m_functions.begin(); fit != m_functions.end(); ++fit) {
-        const BasicBlocks &fcnbb = (*fit).second;
-        BasicBlocks uncovered;
-        BasicBlocks::const_iterator bbit;
-        for (bbit = fcnbb.begin(); bbit != fcnbb.end(); ++bbit) {
-            Block b(0, (*bbit).start, 0);
-            if (m_uniqueTbs.find(b) == m_uniqueTbs.end())
-                os << std::setw(0) << "-";
+    FunctionSummaries::const_iterator sit;
+    TextBuffer out(os);
+
+    for(sit = m_summaries.begin(); sit != m_summaries.end(); ++sit) {
+        BlockIds::const_iterator bbit;
+        BlockIds::const_iterator end = getFunctionEnd((*sit).function);
+        for (bbit = getFunctionBegin((*sit).function); bbit != end; ++bbit) {
+            const BasicBlock &bb = m_allBbs[*bbit];
+            if (!isEntered(*bbit))
+                out << '-';
             else
-                os << std::setw(0) << "+";
+                out << '+';
 
-            os << std::hex << "0x" << std::setfill('0') << std::setw(8) << (*bbit).start << std::setw(0)
-                   << ":0x" << std::setw(8) << (*bbit).end << std::endl;
+            out << "0x" << hexNumber(bb.start, 8, '0')
+                << ":0x" << hexNumber(bb.end, 8, '0') << '\n';
         }
-        os << std::endl;
+        out << '\n';
 
     }
 }
@@ -385,9 +754,8 @@ void BasicBlockCoverage::printBBCov(std::ostream &os) const
 Coverage::Coverage(Library *lib, ModuleCache *cache, LogEvents *events)
 {
     m_events = events;
-    m_connection = events->onEachItem.connect(
-            sigc::mem_fun(*this, &Coverage::onItem)
-            );
+    events->subscribe<Coverage, &Coverage::onItem>(s2e::plugins::TRACE_FORK, this);
+    events->subscribe<Coverage, &Coverage::onItem>(s2e::plugins::TRACE_TB_START, this);
     m_cache = cache;
     m_library = lib;
     m_pathCount = 1;
@@ -396,31 +764,34 @@ Coverage::Coverage(Library *lib, ModuleCache *cache, LogEvents *events)
 
 Coverage::~Coverage()
 {
-    m_connection.disconnect();
+    m_events->unsubscribe(this);
 
     BbCoverageMap::iterator it;
     for (it = m_bbCov.begin(); it != m_bbCov.end(); ++it) {
         delete (*it).second;
     }
+
+    for (unsigned i = 0; i < m_threads.size(); ++i) {
+        delete m_threads[i];
+    }
 }
 
-BasicBlockCoverage *Coverage::loadCoverage(const ModuleInstance *mi)
+BasicBlockCoverage *Coverage::loadCoverage(const std::string &moduleName)
 {
     BasicBlockCoverage *bbcov = NULL;
-    assert(mi);
 
-    BbCoverageMap::iterator it = m_bbCov.find(mi->Name);
+    BbCoverageMap::iterator it = m_bbCov.find(moduleName);
     if (it == m_bbCov.end()) {
         //Look for the file containing the bbs.
         std::string path;
-        if (m_library->findLibrary(mi->Name, path)) {
+        if (m_library->findLibrary(moduleName, path)) {
             llvm::sys::Path modPath(path);
             modPath.eraseComponent();
-            BasicBlockCoverage *bb = new BasicBlockCoverage(modPath.str(), mi->Name);
-            m_bbCov[mi->Name] = bb;
+            BasicBlockCoverage *bb = new BasicBlockCoverage(modPath.str(), moduleName);
+            m_bbCov[moduleName] = bb;
             bbcov = bb;
         } else {
-            m_notFoundModuleImages.insert(mi->Name);
+            m_notFoundModuleImages.insert(moduleName);
         }
     }else {
         bbcov = (*it).second;
@@ -429,13 +800,28 @@ BasicBlockCoverage *Coverage::loadCoverage(const ModuleInstance *mi)
     return bbcov;
 }
 
+Coverage::ThreadCoverage *Coverage::getThreadCoverage()
+{
+    ThreadCoverage *tc = m_threadCoverage.get();
+    if (!tc) {
+        tc = new ThreadCoverage();
+        m_threadCoverage.set(tc);
+
+        llvm::sys::ScopedLock lock(m_lock);
+        m_threads.push_back(tc);
+    }
+    return tc;
+}
+
 void Coverage::onItem(unsigned traceIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             void *item)
 {
+    ThreadCoverage *tc = getThreadCoverage();
+
     if (hdr.type == s2e::plugins::TRACE_FORK) {
         s2e::plugins::ExecutionTraceFork *f = (s2e::plugins::ExecutionTraceFork*)item;
-        m_pathCount+=f->stateCount-1;
+        tc->pathCount+=f->stateCount-1;
     }
 
     if (hdr.type != s2e::plugins::TRACE_TB_START) {
@@ -445,60 +831,194 @@ void Coverage::onItem(unsigned traceIndex,
     const s2e::plugins::ExecutionTraceTb *te =
             (const s2e::plugins::ExecutionTraceTb*) item;
 
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_cache, &ModuleCacheState::factory));
 
     const ModuleInstance *mi = mcs->getInstance(hdr.pid, te->pc);
+
     if (!mi) {
-        ++m_unknownModuleCount;
+        ++tc->unknownModuleCount;
         return;
     }
 
-    BasicBlockCoverage *bbcov = loadCoverage(mi);
-    if (!bbcov) {
+    ThreadCoverage::Instances::iterator it = tc->instances.find(mi);
+    if (it == tc->instances.end()) {
+        BasicBlockCoverage *bbcov;
+        {
+            llvm::sys::ScopedLock lock(m_lock);
+            bbcov = loadCoverage(mi->Name);
+        }
+
+        ThreadCoverage::Modules::iterator mit = tc->modules.end();
+        if (bbcov) {
+            mit = tc->modules.find(bbcov);
+            if (mit == tc->modules.end()) {
+                mit = tc->modules.insert(std::make_pair(bbcov, BasicBlockCoverage::PartialCoverage())).first;
+                if (Streaming) {
+                    bbcov->initPartial((*mit).second);
+                }
+            }
+        }
+
+        it = tc->instances.insert(std::make_pair(mi, mit)).first;
+    }
+
+    if ((*it).second == tc->modules.end()) {
         return;
     }
 
+    const BasicBlockCoverage *bbcov = (*(*it).second).first;
+    BasicBlockCoverage::PartialCoverage &partial = (*(*it).second).second;
+
     uint64_t relPc = te->pc - mi->LoadBase + mi->ImageBase;
 
+    if (Streaming) {
+        bbcov->coverTranslationBlock(partial, hdr.timeStamp, relPc, relPc+te->size-1);
+    } else {
+        bbcov->addTranslationBlock(partial, hdr.timeStamp, relPc, relPc+te->size-1);
+    }
+}
 
+void Coverage::mergeThreadCoverage()
+{
+    for (unsigned i = 0; i < m_threads.size(); ++i) {
+        ThreadCoverage *tc = m_threads[i];
+
+        ThreadCoverage::Modules::iterator it;
+        for (it = tc->modules.begin(); it != tc->modules.end(); ++it) {
+            (*it).first->mergePartial((*it).second);
+        }
+
+        m_pathCount += tc->pathCount;
+        m_unknownModuleCount += tc->unknownModuleCount;
 
-    bbcov->addTranslationBlock(hdr.timeStamp, relPc, relPc+te->size-1);
+        //The threads keep their coverage object
+        tc->modules.clear();
+        tc->instances.clear();
+        tc->pathCount = 0;
+        tc->unknownModuleCount = 0;
+    }
 }
 
-void Coverage::outputCoverage(const std::string &path) const
+bool Coverage::mergeDatabase(const std::string &fileName)
 {
-    BbCoverageMap::const_iterator it;
+    std::string moduleName;
+    if (!BasicBlockCoverage::getDatabaseModule(fileName, moduleName)) {
+        std::cerr << "Could not read coverage database " << fileName << std::endl;
+        return false;
+    }
 
-    for(it = m_bbCov.begin(); it != m_bbCov.end(); ++it) {
+    llvm::sys::ScopedLock lock(m_lock);
+
+    BasicBlockCoverage *bbcov = loadCoverage(moduleName);
+    if (!bbcov) {
+        return false;
+    }
+
+    //Time stamps are merged with the ones of the trace
+    bbcov->convertTbToBb(std::cerr);
+    return bbcov->mergeDatabase(fileName);
+}
+
+//Writes the reports of one module, errors are
+//buffered when several modules are processed at once
+void Coverage::outputModule(const std::string &path, const std::string &moduleName,
+                            BasicBlockCoverage *bbcov, std::ostream &errors) const
+{
+    uint64_t pathCount = m_pathCount + bbcov->getMergedPathCount();
+
+    bool timeBlocks = TimeBucket == 0 || TimeBlocks;
+
+    bbcov->convertTbToBb(errors);
+    bbcov->summarize(timeBlocks);
+
+    if (timeBlocks) {
         std::stringstream ss;
-        ss << path << "/" << (*it).first << ".timecov";
+        ss << path << "/" << moduleName << ".timecov";
         std::ofstream timecov(ss.str().c_str());
+        bbcov->printTimeCoverage(timecov);
+    }
 
-        (*it).second->convertTbToBb();
-        (*it).second->printTimeCoverage(timecov);
+    if (TimeBucket > 0) {
+        std::stringstream ss;
+        ss << path << "/" << moduleName << ".timecurve";
+        std::ofstream timecurve(ss.str().c_str());
+        bbcov->printTimeCurve(timecurve);
+    }
 
-        std::stringstream ss1;
-        ss1 << path << "/" << (*it).first << ".repcov";
-        std::ofstream report(ss1.str().c_str());
-        (*it).second->printReport(report, m_pathCount);
+    std::stringstream ss1;
+    ss1 << path << "/" << moduleName << ".repcov";
+    std::ofstream report(ss1.str().c_str());
+    bbcov->printReport(report, pathCount);
+
+    if (bbcov->hasIgnoredFunctions() > 0) {
+        std::stringstream ss11;
+        ss11 << path << "/" << moduleName << ".repcov-filtered";
+        std::ofstream report(ss11.str().c_str());
+        bbcov->printReport(report, pathCount, true);
+
+        std::stringstream ss12;
+        ss12 << path << "/" << moduleName << ".repcov-filtered.csv";
+        std::ofstream reportcsv(ss12.str().c_str());
+        bbcov->printReport(reportcsv, pathCount, true, true);
+    }
+
+
+    std::stringstream ss2;
+    ss2 << path << "/" << moduleName << ".bbcov";
+    std::ofstream bbcovFile(ss2.str().c_str());
+    bbcov->printBBCov(bbcovFile);
+
+    std::stringstream ss3;
+    ss3 << path << "/" << moduleName << ".covdb";
+    bbcov->saveDatabase(ss3.str(), pathCount);
+}
 
-        if ((*it).second->hasIgnoredFunctions() > 0) {
-            std::stringstream ss11;
-            ss11 << path << "/" << (*it).first << ".repcov-filtered";
-            std::ofstream report(ss11.str().c_str());
-            (*it).second->printReport(report, m_pathCount, true);
+struct Coverage::OutputTask: public ThreadPoolTask
+{
+    const Coverage *coverage;
+    const std::string *path;
+    BbCoverageMap::const_iterator module;
+    std::stringstream errors;
+
+    OutputTask(const Coverage *c, const std::string *p, BbCoverageMap::const_iterator m) {
+        coverage = c;
+        path = p;
+        module = m;
+    }
 
-            std::stringstream ss12;
-            ss12 << path << "/" << (*it).first << ".repcov-filtered.csv";
-            std::ofstream reportcsv(ss12.str().c_str());
-            (*it).second->printReport(reportcsv, m_pathCount, true, true);
+    void run() {
+        coverage->outputModule(*path, (*module).first, (*module).second, errors);
+    }
+};
+
+//Modules are independent, their reports are written in parallel.
+//Errors are printed afterwards in the order of the serial version.
+void Coverage::outputCoverage(const std::string &path) const
+{
+    BbCoverageMap::const_iterator it;
+
+    if (ThreadPool::getDefaultThreadCount() > 1 && m_bbCov.size() > 1) {
+        std::vector<OutputTask*> tasks;
+
+        {
+            ThreadPool pool;
+            for(it = m_bbCov.begin(); it != m_bbCov.end(); ++it) {
+                OutputTask *task = new OutputTask(this, &path, it);
+                tasks.push_back(task);
+                pool.submit(task);
+            }
+            pool.wait();
         }
 
+        for (unsigned i = 0; i < tasks.size(); ++i) {
+            std::cerr << tasks[i]->errors.str();
+            delete tasks[i];
+        }
+        return;
+    }
 
-        std::stringstream ss2;
-        ss2 << path << "/" << (*it).first << ".bbcov";
-        std::ofstream bbcov(ss2.str().c_str());
-        (*it).second->printBBCov(bbcov);
+    for(it = m_bbCov.begin(); it != m_bbCov.end(); ++it) {
+        outputModule(path, (*it).first, (*it).second, std::cerr);
     }
 }
 
@@ -519,11 +1039,21 @@ void Coverage::printErrors() const
             std::cerr << *it << "\n";
         }
     }
+
+    BbCoverageMap::const_iterator bit;
+    for (bit = m_bbCov.begin(); bit != m_bbCov.end(); ++bit) {
+        uint64_t count = (*bit).second->getMissingTbCount();
+        if (count) {
+            std::cerr << "There were " << count << " translation blocks of " << (*bit).first
+                    << " that are not entirely in the basic block list.\n";
+        }
+    }
 }
 
 CoverageTool::CoverageTool()
 {
     m_binaries.setPaths(ModDir);
+    m_binaries.prefetchModules(&m_parser);
 }
 
 CoverageTool::~CoverageTool()
@@ -534,12 +1064,28 @@ CoverageTool::~CoverageTool()
 void CoverageTool::flatTrace()
 {
     PathBuilder pb(&m_parser);
-    m_parser.parse(TraceFiles);
+    if (!TraceFiles.empty()) {
+        if (!pb.canReplay()) {
+            return;
+        }
+        m_parser.parse(TraceFiles);
+    }
 
     ModuleCache mc(&pb);
     Coverage cov(&m_binaries, &mc, &pb);
 
-    pb.processTree();
+    if (!TraceFiles.empty()) {
+        pb.processTree();
+        cov.mergeThreadCoverage();
+    } else {
+        //Only merging previous results
+        cov.setPathCount(0);
+    }
+
+    for (unsigned i = 0; i < MergeFiles.size(); ++i) {
+        cov.mergeDatabase(MergeFiles[i]);
+    }
+
     cov.printErrors();
 
     cov.outputCoverage(LogDir);
@@ -40,12 +40,17 @@
 #include <lib/ExecutionTracer/ModuleParser.h>
 
 #include <lib/BinaryReaders/Library.h>
+#include <lib/Utils/BasicBlockList.h>
+
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/ThreadLocal.h"
 
 #include <inttypes.h>
 #include <ostream>
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace s2etools
 {
@@ -73,8 +78,8 @@ struct BasicBlock
     struct SortByTime {
 
         bool operator()(const BasicBlock&b1, const BasicBlock &b2) const {
-            if (b1.timeStamp < b2.timeStamp) {
-                return true;
+            if (b1.timeStamp != b2.timeStamp) {
+                return b1.timeStamp < b2.timeStamp;
             }
             return b1.start < b2.start;
         }
@@ -109,22 +114,165 @@ class BasicBlockCoverage
 {
 public:
 
-    typedef std::set<BasicBlock, BasicBlock> BasicBlocks;
+    typedef std::vector<BasicBlock> BasicBlockArray;
     typedef std::set<Block, Block> Blocks;
-    typedef std::set<BasicBlock, BasicBlock::SortByTime> BlocksByTime;
-    typedef std::map<std::string, BasicBlocks> Functions;
+
+    //Indexes in m_allBbs
+    typedef std::vector<uint32_t> BlockIds;
+
+    //Coverage of a function, shared by the reports
+    struct FunctionSummary {
+        uint32_t function;
+        unsigned coveredCount;
+        bool ignored;
+    };
+
+    typedef std::vector<FunctionSummary> FunctionSummaries;
 
     typedef std::set<std::string> FunctionNames;
 
+    //Number of blocks first covered in each time interval
+    typedef std::map<uint64_t, uint32_t> TimeHistogram;
+
+    static const uint32_t NO_BLOCK = 0xffffffff;
+    static const unsigned PAGE_BITS = 12;
+
+    static const uint32_t DB_MAGIC = 0x564f4353; //SCOV
+    static const uint32_t DB_VERSION = 1;
+
+    //Coverage collected by one thread without modifying the module,
+    //added to it by mergePartial(). Holds the TBs, or in streaming
+    //mode the earliest time stamp of each block.
+    struct PartialCoverage {
+        Blocks tbs;
+        std::vector<uint64_t> times;
+        std::vector<uint32_t> entered;
+        uint64_t missingTbCount;
+
+        PartialCoverage() {
+            missingTbCount = 0;
+        }
+    };
+
 private:
     std::string m_name;
-    BasicBlocks m_allBbs;
-    BasicBlocks m_coveredBbs;
-    Functions m_functions;
 
-    Functions m_coveredFunctions;
+    //All the basic blocks of the module, sorted by address.
+    //The time stamp is the one of the first TB that covered the block.
+    BasicBlockArray m_allBbs;
+
+    //One bit per block of m_allBbs
+    std::vector<uint32_t> m_coveredBbs;
+    unsigned m_coveredCount;
+
+    //Blocks that were the start of a TB
+    std::vector<uint32_t> m_enteredBbs;
+
+    //TBs that contain bytes outside of any block,
+    //when they are not reported individually
+    uint64_t m_missingTbCount;
+
+    //Number of paths of the merged coverage databases
+    uint64_t m_mergedPathCount;
+
+    //Blocks and function names of the .bblist file. Functions are
+    //numbered in the order of their names, which stay in the list.
+    BasicBlockList m_list;
+
+    //Block ids of all the functions, one range per function, sorted by
+    //address within a range. Function f covers the ids from
+    //m_functionStarts[f] to m_functionStarts[f + 1] in m_functionBlocks.
+    BlockIds m_functionStarts;
+    BlockIds m_functionBlocks;
+
+    //Function of each block
+    std::vector<uint32_t> m_blockFunctions;
+
+    //Computed by summarize() for the reports
+    FunctionSummaries m_summaries;
+    BasicBlockArray m_blocksByTime;
+    uint64_t m_firstTime, m_lastTime;
+
+    //Updated whenever the time stamp of a covered block changes.
+    //The width of the intervals is in microseconds, 0 if disabled.
+    uint64_t m_timeBucket;
+    TimeHistogram m_timeHistogram;
+
+    //Id of the block that contains each address, one page at a time.
+    //Pages are filled the first time a TB falls into them.
+    uint64_t m_firstPage;
+    std::vector<BlockIds> m_pageTable;
+
     FunctionNames m_ignoredFunctions;
     Blocks m_uniqueTbs;
+
+    uint32_t getBlockId(uint64_t address);
+    uint32_t findBlockId(uint64_t address) const;
+    uint64_t getBlockListHash() const;
+    void buildPage(BlockIds &page, uint64_t pageStart) const;
+
+    bool isCovered(uint32_t id) const {
+        return m_coveredBbs[id / 32] & (1u << (id % 32));
+    }
+
+    bool isEntered(uint32_t id) const {
+        return m_enteredBbs[id / 32] & (1u << (id % 32));
+    }
+
+    void setEntered(uint64_t tbStart) {
+        uint32_t id = getBlockId(tbStart);
+        if (id != NO_BLOCK && m_allBbs[id].start == tbStart) {
+            m_enteredBbs[id / 32] |= 1u << (id % 32);
+        }
+    }
+
+    unsigned getFunctionCount() const {
+        return m_functionStarts.size() - 1;
+    }
+
+    const char *getFunctionName(uint32_t function) const {
+        return m_list.getFunctionName(function);
+    }
+
+    BlockIds::const_iterator getFunctionBegin(uint32_t function) const {
+        return m_functionBlocks.begin() + m_functionStarts[function];
+    }
+
+    BlockIds::const_iterator getFunctionEnd(uint32_t function) const {
+        return m_functionBlocks.begin() + m_functionStarts[function + 1];
+    }
+
+    void addTime(uint64_t timeStamp) {
+        if (m_timeBucket) {
+            ++m_timeHistogram[timeStamp / m_timeBucket];
+        }
+    }
+
+    void removeTime(uint64_t timeStamp) {
+        if (m_timeBucket) {
+            TimeHistogram::iterator it = m_timeHistogram.find(timeStamp / m_timeBucket);
+            if (--(*it).second == 0) {
+                m_timeHistogram.erase(it);
+            }
+        }
+    }
+
+    void setCovered(uint32_t id, uint64_t timeStamp) {
+        m_coveredBbs[id / 32] |= 1u << (id % 32);
+        m_allBbs[id].timeStamp = timeStamp;
+        ++m_coveredCount;
+        addTime(timeStamp);
+    }
+
+    //The block must be covered
+    void lowerTime(uint32_t id, uint64_t timeStamp) {
+        if (timeStamp < m_allBbs[id].timeStamp) {
+            removeTime(m_allBbs[id].timeStamp);
+            m_allBbs[id].timeStamp = timeStamp;
+            addTime(timeStamp);
+        }
+    }
+
 public:
     BasicBlockCoverage(const std::string &moduleDir,
                    const std::string &moduleName);
@@ -133,11 +281,35 @@ public:
                           const std::string &moduleName);
 
     //Start and end must be local to the module
-    //Returns true if the added block resulted in covering new basic blocks
-    bool addTranslationBlock(uint64_t ts, uint64_t start, uint64_t end);
+    //Keeps the earliest time stamp of each TB
+    void addTranslationBlock(uint64_t ts, uint64_t start, uint64_t end);
+
+    //Sizes the block arrays of a streaming partial coverage
+    void initPartial(PartialCoverage &partial) const;
+
+    //Same as addTranslationBlock, into a partial coverage
+    void addTranslationBlock(PartialCoverage &partial, uint64_t ts, uint64_t start, uint64_t end) const;
+
+    //Maps the TB to basic blocks without storing it, the blocks get the
+    //earliest time stamp that covered them. The partial coverage must
+    //have been initialized with initPartial().
+    void coverTranslationBlock(PartialCoverage &partial, uint64_t ts, uint64_t start, uint64_t end) const;
+
+    void mergePartial(const PartialCoverage &partial);
+
     uint64_t getTimeCoverage() const;
-    void convertTbToBb();
+    void convertTbToBb(std::ostream &errors);
+
+    //Computes the coverage of each function. The covered blocks are
+    //sorted by time for printTimeCoverage if sortByTime is set.
+    //Must be called before printing the reports.
+    void summarize(bool sortByTime);
+
+    //One line per covered block
     void printTimeCoverage(std::ostream &os) const;
+
+    //One line per time interval in which blocks were covered
+    void printTimeCurve(std::ostream &os) const;
     void printReport(std::ostream &os, uint64_t pathCount, bool useIgnoreList = false, bool csv = false) const;
     void printBBCov(std::ostream &os) const;
 
@@ -146,6 +318,21 @@ public:
         return m_ignoredFunctions.size() > 0;
     }
 
+    uint64_t getMissingTbCount() const {
+        return m_missingTbCount;
+    }
+
+    uint64_t getMergedPathCount() const {
+        return m_mergedPathCount;
+    }
+
+    //Coverage databases store the covered blocks and their time stamps.
+    //They can be merged with the results of other runs that used the same
+    //basic block list.
+    bool saveDatabase(const std::string &fileName, uint64_t pathCount) const;
+    bool mergeDatabase(const std::string &fileName);
+    static bool getDatabaseModule(const std::string &fileName, std::string &moduleName);
+
 };
 
 class Coverage
@@ -157,7 +344,6 @@ private:
     ModuleCache *m_cache;
     Library *m_library;
 
-    sigc::connection m_connection;
     uint64_t m_pathCount;
 
     typedef std::map<std::string, BasicBlockCoverage*> BbCoverageMap;
@@ -172,7 +358,39 @@ private:
     /* BB lists that were not found. */
     std::set<std::string> m_notFoundBbList;
 
-    BasicBlockCoverage *loadCoverage(const ModuleInstance *mi);
+    //Coverage collected by one thread of processTree(), without locking.
+    //Added to the modules by mergeThreadCoverage().
+    struct ThreadCoverage {
+        typedef std::map<BasicBlockCoverage*, BasicBlockCoverage::PartialCoverage> Modules;
+        typedef std::map<const ModuleInstance*, Modules::iterator> Instances;
+
+        Modules modules;
+
+        //Coverage of the module of each instance seen by the thread,
+        //modules.end() if the module has no basic block list
+        Instances instances;
+
+        uint64_t pathCount;
+        uint64_t unknownModuleCount;
+
+        ThreadCoverage() {
+            pathCount = 0;
+            unknownModuleCount = 0;
+        }
+    };
+
+    llvm::sys::ThreadLocal<ThreadCoverage> m_threadCoverage;
+    std::vector<ThreadCoverage*> m_threads;
+
+    /* Protects m_bbCov, the sets of missing modules and m_threads */
+    llvm::sys::Mutex m_lock;
+
+    BasicBlockCoverage *loadCoverage(const std::string &moduleName);
+    ThreadCoverage *getThreadCoverage();
+
+    struct OutputTask;
+    void outputModule(const std::string &path, const std::string &moduleName,
+                      BasicBlockCoverage *bbcov, std::ostream &errors) const;
 
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
@@ -188,6 +406,15 @@ public:
         return m_pathCount;
     }
 
+    void setPathCount(uint64_t count) {
+        m_pathCount = count;
+    }
+
+    //Must be called once the trace is processed
+    void mergeThreadCoverage();
+
+    bool mergeDatabase(const std::string &fileName);
+
     void printErrors() const;
 
 };
@@ -102,10 +102,10 @@ void ExecutionDebugger::onItem(unsigned traceIndex,
 
     ExecutionTraceTb *tb = (ExecutionTraceTb*) item;
 
-    m_os << " pc=0x" << std::hex << tb->pc <<
-            " tpc=0x" << std::hex <<  tb->targetPc ;
+    m_os << " pc=0x" << hexNumber(tb->pc) <<
+            " tpc=0x" << hexNumber(tb->targetPc);
 
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_cache, &ModuleCacheState::factory));
     const ModuleInstance *mi = mcs->getInstance(hdr.pid, tb->pc);
     std::string dbg;
     if (m_library->print(mi, tb->pc, dbg, true, true, true)) {
@@ -140,7 +140,7 @@ MemoryDebugger::~MemoryDebugger()
 
 void MemoryDebugger::printHeader(const s2e::plugins::ExecutionTraceItemHeader &hdr)
 {
-    m_os << "[State " << std::dec << hdr.stateId << "]";
+    m_os << "[State " << decNumber(hdr.stateId) << "]";
 }
 
 void MemoryDebugger::doLookForValue(const s2e::plugins::ExecutionTraceItemHeader &hdr,
@@ -153,13 +153,13 @@ void MemoryDebugger::doLookForValue(const s2e::plugins::ExecutionTraceItemHeader
 }*/
 
     printHeader(hdr);
-    m_os << " pc=0x" << std::hex << item.pc <<
-            " addr=0x" << item.address <<
-            " val=0x" << item.value <<
-            " size=" << std::dec << (unsigned)item.size <<
-            " iswrite=" << (item.flags & EXECTRACE_MEM_WRITE);
+    m_os << " pc=0x" << hexNumber(item.pc) <<
+            " addr=0x" << hexNumber(item.address) <<
+            " val=0x" << hexNumber(item.value) <<
+            " size=" << decNumber(item.size) <<
+            " iswrite=" << decNumber(item.flags & EXECTRACE_MEM_WRITE);
 
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_cache, &ModuleCacheState::factory));
     const ModuleInstance *mi = mcs->getInstance(hdr.pid, item.pc);
     std::string dbg;
     if (m_library->print(mi, item.pc, dbg, true, true, true)) {
@@ -174,11 +174,11 @@ void MemoryDebugger::doPageFault(const s2e::plugins::ExecutionTraceItemHeader &h
                                  const s2e::plugins::ExecutionTracePageFault &item)
 {
     printHeader(hdr);
-    m_os << " pc=0x" << std::hex << item.pc <<
-            " addr=0x" << item.address <<
-            " iswrite=" << (bool)item.isWrite;
+    m_os << " pc=0x" << hexNumber(item.pc) <<
+            " addr=0x" << hexNumber(item.address) <<
+            " iswrite=" << decNumber(item.isWrite != 0);
 
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_cache, &ModuleCacheState::factory));
     const ModuleInstance *mi = mcs->getInstance(hdr.pid, item.pc);
     std::string dbg;
     if (m_library->print(mi, item.pc, dbg, true, true, true)) {
@@ -40,6 +40,7 @@
 #include <lib/ExecutionTracer/ModuleParser.h>
 
 #include <lib/BinaryReaders/Library.h>
+#include <lib/Utils/TextBuffer.h>
 
 #include <ostream>
 
@@ -49,7 +50,7 @@ namespace s2etools
 class ExecutionDebugger
 {
 private:
-    std::ostream &m_os;
+    TextBuffer m_os;
 
     LogEvents *m_events;
     ModuleCache *m_cache;
@@ -77,7 +78,7 @@ private:
         LOOK_FOR_VALUE
     };
 
-    std::ostream &m_os;
+    TextBuffer m_os;
 
     LogEvents *m_events;
     ModuleCache *m_cache;
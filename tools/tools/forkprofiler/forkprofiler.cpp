@@ -41,6 +41,7 @@
 #include <lib/ExecutionTracer/Path.h>
 #include <lib/ExecutionTracer/TestCase.h>
 #include <lib/BinaryReaders/BFDInterface.h>
+#include <lib/Utils/TextBuffer.h>
 
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
 
@@ -51,6 +52,7 @@
 #include <sstream>
 #include <inttypes.h>
 #include <iomanip>
+#include <algorithm>
 #include "forkprofiler.h"
 
 using namespace llvm;
@@ -77,23 +79,21 @@ namespace s2etools
 ForkProfiler::ForkProfiler(Library *lib, ModuleCache *cache, LogEvents *events)
 {
     m_events = events;
-    m_connection = events->onEachItem.connect(
-            sigc::mem_fun(*this, &ForkProfiler::onItem)
-            );
+    events->subscribe<ForkProfiler, &ForkProfiler::onItem>(s2e::plugins::TRACE_FORK, this);
     m_cache = cache;
     m_library = lib;
 }
 
 ForkProfiler::~ForkProfiler()
 {
-    m_connection.disconnect();
+    m_events->unsubscribe(this);
 }
 
 void ForkProfiler::doProfile(
         const s2e::plugins::ExecutionTraceItemHeader &hdr,
         const s2e::plugins::ExecutionTraceFork *te)
 {
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_cache, &ModuleCacheState::factory));
 
     const ModuleInstance *mi = mcs->getInstance(hdr.pid, te->pc);
 
@@ -126,14 +126,16 @@ void ForkProfiler::doProfile(
 }
 
 void ForkProfiler::doGraph(
+        unsigned traceIndex,
         const s2e::plugins::ExecutionTraceItemHeader &hdr,
         const s2e::plugins::ExecutionTraceFork *te)
 {
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_cache, &ModuleCacheState::factory));
 
     const ModuleInstance *mi = mcs->getInstance(hdr.pid, te->pc);
 
     Fork f;
+    f.traceIndex = traceIndex;
     f.id = hdr.stateId;
     f.pid = hdr.pid;
     f.pc = te->pc;
@@ -155,15 +157,12 @@ void ForkProfiler::onItem(unsigned traceIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             void *item)
 {
-    if (hdr.type != s2e::plugins::TRACE_FORK) {
-        return;
-    }
-
     const s2e::plugins::ExecutionTraceFork *te =
             (const s2e::plugins::ExecutionTraceFork*) item;
 
+    llvm::sys::ScopedLock lock(m_lock);
     doProfile(hdr, te);
-    doGraph(hdr, te);
+    doGraph(traceIndex, hdr, te);
 
 }
 
@@ -176,11 +175,16 @@ static std::string getColor(unsigned val, unsigned maxval)
     return buf;
 }
 
-void ForkProfiler::outputGraph(const std::string &path) const
+void ForkProfiler::outputGraph(const std::string &path)
 {
+    //Subtrees may have been processed in any order. The numbering
+    //of the nodes requires the forks to be sorted by trace order.
+    std::sort(m_forks.begin(), m_forks.end(), ForkByTraceIndex());
+
     std::stringstream ss;
     ss << path << "/" << "statetree.dot";
-    std::ofstream tree(ss.str().c_str());
+    std::ofstream treeFile(ss.str().c_str());
+    TextBuffer tree(treeFile);
 
     std::map<uint32_t, uint32_t> stateIdMap;
 
@@ -195,7 +199,7 @@ void ForkProfiler::outputGraph(const std::string &path) const
 
 
 
-    tree << "digraph G {" << std::endl;
+    tree << "digraph G {\n";
 
     ForkList::const_iterator it;
     for(it = m_forks.begin(); it != m_forks.end(); ++it) {
@@ -212,20 +216,19 @@ void ForkProfiler::outputGraph(const std::string &path) const
         }
 
 
-        tree << "s" << f.id << "_" << newId << " [label=\"" <<
-                std::hex << f.relPc << std::dec << "\" " <<
-                "style=filled fillcolor=\"" << getColor(density, maxCount) << "\"];"
-
-                << std::endl;
+        tree << "s" << decNumber(f.id) << "_" << decNumber(newId) << " [label=\"" <<
+                hexNumber(f.relPc) << "\" " <<
+                "style=filled fillcolor=\"" << getColor(density, maxCount) << "\"];\n";
         for (unsigned i=0; i<f.children.size(); ++i) {
             uint32_t newChild = stateIdMap[f.children[i]] + 1;
             stateIdMap[f.children[i]] = newChild;
 
-            tree << "s" << f.id << "_" << newId << "->" << "s" << f.children[i] << "_" << newChild << ";" << std::endl;
+            tree << "s" << decNumber(f.id) << "_" << decNumber(newId) << "->" << "s"
+                 << decNumber(f.children[i]) << "_" << decNumber(newChild) << ";\n";
         }
     }
 
-    tree << "}" << std::endl;
+    tree << "}\n";
 }
 
 void ForkProfiler::outputProfile(const std::string &path) const
@@ -284,7 +287,12 @@ int main(int argc, char **argv)
     library.setPaths(ModDir);
 
     LogParser parser;
+    library.prefetchModules(&parser);
     PathBuilder pb(&parser);
+    if (!pb.canReplay()) {
+        return -1;
+    }
+
     parser.parse(TraceFiles);
 
     ModuleCache mc(&pb);
@@ -41,6 +41,8 @@
 
 #include <lib/BinaryReaders/Library.h>
 
+#include "llvm/Support/Mutex.h"
+
 #include <ostream>
 
 namespace s2etools
@@ -51,6 +53,7 @@ class ForkProfiler
 public:
 
     struct Fork {
+        uint32_t traceIndex;
         uint32_t id;
         uint64_t pid;
         uint64_t relPc, pc;
@@ -88,6 +91,12 @@ public:
         }
     };
 
+    struct ForkByTraceIndex {
+        bool operator()(const Fork &f1, const Fork &f2) const {
+            return f1.traceIndex < f2.traceIndex;
+        }
+    };
+
     typedef std::vector<Fork> ForkList;
     typedef std::set<ForkPoint, ForkPoint> ForkPoints;
     typedef std::set<ForkPoint, ForkPointByCount> ForkPointsByCount;
@@ -96,10 +105,12 @@ private:
     ModuleCache *m_cache;
     Library *m_library;
 
-    sigc::connection m_connection;
     ForkList m_forks;
     ForkPoints m_forkPoints;
 
+    //Protects m_forks and m_forkPoints
+    llvm::sys::Mutex m_lock;
+
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
                 void *item);
@@ -108,6 +119,7 @@ private:
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             const s2e::plugins::ExecutionTraceFork *te);
     void doGraph(
+            unsigned traceIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             const s2e::plugins::ExecutionTraceFork *te);
 
@@ -118,7 +130,7 @@ public:
     void process();
 
     void outputProfile(const std::string &path) const;
-    void outputGraph(const std::string &path) const;
+    void outputGraph(const std::string &path);
 };
 
 }
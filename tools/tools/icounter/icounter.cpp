@@ -121,6 +121,10 @@ int main(int argc, char **argv)
 
     LogParser parser;
     PathBuilder pb(&parser);
+    if (!pb.canReplay()) {
+        return -1;
+    }
+
     parser.parse(TraceFiles);
 
     ModuleCache mc(&pb);
@@ -59,15 +59,13 @@ CacheProfiler::CacheProfiler(ModuleCache *modCache, LogEvents *events)
 {
     m_moduleCache = modCache;
     m_Events = events;
-    m_connection = events->onEachItem.connect(
-            sigc::mem_fun(*this, &CacheProfiler::onItem)
-            );
+    events->subscribe<CacheProfiler, &CacheProfiler::onItem>(s2e::plugins::TRACE_CACHESIM, this);
 }
 
 CacheProfiler::~CacheProfiler()
 {
     Caches::iterator it;
-    m_connection.disconnect();
+    m_Events->unsubscribe(this);
     for (it = m_caches.begin(); it != m_caches.end(); ++it) {
         delete (*it).second;
     }
@@ -80,17 +78,15 @@ void CacheProfiler::onItem(unsigned traceIndex,
 {
     //std::cout << "Processing entry " << std::dec << traceIndex << " - " << (int)hdr.type << std::endl;
 
-    if (hdr.type != s2e::plugins::TRACE_CACHESIM) {
-        return;
-    }
-
     ExecutionTraceCache *e = (ExecutionTraceCache*)item;
 
 
     if (e->type == s2e::plugins::CACHE_NAME) {
+        llvm::sys::ScopedLock lock(m_lock);
         std::string s((const char*)e->name.name, e->name.length);
         m_cacheIds[e->name.id] = s;
     }else if (e->type == s2e::plugins::CACHE_PARAMS) {
+        llvm::sys::ScopedLock lock(m_lock);
         CacheIdToName::iterator it = m_cacheIds.find(e->params.cacheId);
         assert(it != m_cacheIds.end());
 
@@ -170,22 +166,26 @@ ItemProcessorState *CacheProfilerState::clone() const
 
 void CacheProfilerState::processCacheItem(CacheProfiler *cp, uint64_t pid, const ExecutionTraceCacheSimEntry *e)
 {
-    Caches::iterator it = cp->m_caches.find(e->cacheId);
-    assert(it != cp->m_caches.end());
-
-    Cache *c = (*it).second;
-    assert(c);
-
-    if (e->missCount > 0) {
-        if (e->isWrite) {
-            c->m_TotalMissesOnWrite += e->missCount;
-        }else {
-            c->m_TotalMissesOnRead += e->missCount;
+    Cache *c;
+    {
+        llvm::sys::ScopedLock lock(cp->m_lock);
+        Caches::iterator it = cp->m_caches.find(e->cacheId);
+        assert(it != cp->m_caches.end());
+
+        c = (*it).second;
+        assert(c);
+
+        if (e->missCount > 0) {
+            if (e->isWrite) {
+                c->m_TotalMissesOnWrite += e->missCount;
+            }else {
+                c->m_TotalMissesOnRead += e->missCount;
+            }
         }
     }
 
     //Update the per-instruction statistics
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(cp->m_Events->getState(cp->m_moduleCache, &ModuleCacheState::factory));
+    const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(cp->m_Events->getConstState(cp->m_moduleCache, &ModuleCacheState::factory));
     assert(mcs);
 
     InstructionCacheStatistics s;
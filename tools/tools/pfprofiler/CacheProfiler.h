@@ -42,6 +42,8 @@
 
 #include <lib/BinaryReaders/Library.h>
 
+#include "llvm/Support/Mutex.h"
+
 
 #include <string>
 #include <set>
@@ -153,10 +155,11 @@ private:
     s2etools::LogEvents *m_Events;
     s2etools::ModuleCache *m_moduleCache;
 
-    sigc::connection m_connection;
     Caches m_caches;
     CacheIdToName m_cacheIds;
 
+    //Protects m_caches, m_cacheIds and the total miss counts of the caches
+    llvm::sys::Mutex m_lock;
 
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
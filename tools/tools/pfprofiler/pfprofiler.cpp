@@ -120,6 +120,7 @@ PfProfiler::PfProfiler(const std::string &file)
     m_FileName = file;
     m_ModuleCache = NULL;
     m_binaries.setPaths(ModDir);
+    m_binaries.prefetchModules(&m_Parser);
 }
 
 PfProfiler::~PfProfiler()
@@ -146,6 +147,10 @@ void PfProfiler::extractAggregatedData()
     statsFile << "#Path TestCase PageFaults TlbMisses ICount" << std::endl;
 
     PathBuilder pb(&m_Parser);
+    if (!pb.canReplay()) {
+        return;
+    }
+
     m_Parser.parse(m_FileName);
 
     TestCase tc(&pb);
@@ -220,6 +225,10 @@ void PfProfiler::process()
 
 
     PathBuilder pb(&m_Parser);
+    if (!pb.canReplay()) {
+        return;
+    }
+
     m_Parser.parse(m_FileName);
 
     ModuleCache mc(&pb);
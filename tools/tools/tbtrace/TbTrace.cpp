@@ -38,6 +38,7 @@
 #include "llvm/Support/CommandLine.h"
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -99,23 +100,112 @@ cl::opt<bool>
 namespace s2etools
 {
 
-TbTrace::TbTrace(Library *lib, ModuleCache *cache, LogEvents *events, std::ofstream &of)
-    :m_output(of)
+const unsigned TbTraceBatch::MAX_SIZE;
+
+TbTraceBatch::TbTraceBatch(TbTrace *trace)
+{
+    m_trace = trace;
+    m_submitted = false;
+    m_hasModuleInfo = false;
+    m_hasDebugInfo = false;
+}
+
+void TbTraceBatch::add(const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                       const void *item, const ModuleInstance *module)
+{
+    Item i;
+    i.hdr = hdr;
+    i.module = module;
+    i.offset = m_data.size();
+    m_items.push_back(i);
+
+    m_data.resize(m_data.size() + (hdr.size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    memcpy(&m_data[i.offset], item, hdr.size);
+}
+
+void TbTraceBatch::run()
+{
+    TextBuffer os;
+    for (unsigned i = 0; i < m_items.size(); ++i) {
+        m_trace->formatItem(this, os, m_items[i]);
+    }
+
+    m_output.swap(os.str());
+
+    //The output is all that is needed from now on
+    std::vector<Item>().swap(m_items);
+    std::vector<uint64_t>().swap(m_data);
+}
+
+TbTrace::TbTrace(Library *lib, ModuleCache *cache, LogEvents *events)
 {
+    static const unsigned types[] = {
+        s2e::plugins::TRACE_MOD_LOAD, s2e::plugins::TRACE_MOD_UNLOAD,
+        s2e::plugins::TRACE_PAGEFAULT, s2e::plugins::TRACE_EXCEPTION,
+        s2e::plugins::TRACE_STATE_SWITCH, s2e::plugins::TRACE_FORK,
+        s2e::plugins::TRACE_TB_START
+    };
+
     m_events = events;
-    m_connection = events->onEachItem.connect(
-            sigc::mem_fun(*this, &TbTrace::onItem)
-            );
+    for (unsigned i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        events->subscribe<TbTrace, &TbTrace::onItem>(types[i], this);
+    }
+
+    if (PrintMemory) {
+        events->subscribe<TbTrace, &TbTrace::onItem>(s2e::plugins::TRACE_MEMORY, this);
+    }
+
+    if (PrintMemoryChecker) {
+        events->subscribe<TbTrace, &TbTrace::onItem>(s2e::plugins::TRACE_MEM_CHECKER, this);
+    }
+
     m_cache = cache;
     m_library = lib;
-    m_hasItems = false;
-    m_hasDebugInfo = false;
-    m_hasModuleInfo = false;
+
+    m_pool = NULL;
+    if (ThreadPool::getDefaultThreadCount() > 1) {
+        m_pool = new ThreadPool();
+    }
 }
 
 TbTrace::~TbTrace()
 {
-    m_connection.disconnect();
+    m_events->unsubscribe(this);
+
+    if (m_pool) {
+        m_pool->wait();
+        delete m_pool;
+    }
+
+    ModuleBasicBlocks::iterator it;
+    for (it = m_basicBlocks.begin(); it != m_basicBlocks.end(); ++it) {
+        delete (*it).second;
+    }
+}
+
+void TbTrace::submit(TbTraceBatch *batch)
+{
+    batch->m_submitted = true;
+    if (m_pool) {
+        m_pool->submit(batch);
+    } else {
+        batch->run();
+    }
+}
+
+void TbTrace::flush(const TbTraceState *state)
+{
+    for (const TbTraceState *s = state; s; s = s->m_parent) {
+        for (unsigned i = 0; i < s->m_batches.size(); ++i) {
+            if (!s->m_batches[i]->m_submitted) {
+                submit(s->m_batches[i]);
+            }
+        }
+    }
+
+    if (m_pool) {
+        m_pool->wait();
+    }
 }
 
 bool TbTrace::parseDisassembly(const std::string &listingFile, Disassembly &out)
@@ -162,19 +252,24 @@ bool TbTrace::parseDisassembly(const std::string &listingFile, Disassembly &out)
     return added;
 }
 
-void TbTrace::printDisassembly(const std::string &module, uint64_t relPc, unsigned tbSize)
+//The listings do not change once loaded, the lock only
+//needs to be held while looking them up.
+bool TbTrace::getListings(const std::string &module, const ModuleDisassembly *&disassembly,
+                          const BasicBlockList *&bbs)
 {
+    llvm::sys::ScopedLock lock(m_listingLock);
+
     Disassembly::iterator it = m_disassembly.find(module);
     if (it == m_disassembly.end()) {
         llvm::sys::Path disassemblyListing;
         if (!m_library->findDisassemblyListing(module, disassemblyListing)) {
             std::cerr << "Could not find disassembly listing for module "
                          << module << std::endl;
-            return;
+            return false;
         }
 
         if (!parseDisassembly(disassemblyListing.str(), m_disassembly)) {
-            return;
+            return false;
         }
         it = m_disassembly.find(module);
         assert(it != m_disassembly.end());
@@ -191,32 +286,41 @@ void TbTrace::printDisassembly(const std::string &module, uint64_t relPc, unsign
             exit(-1);
         }
 
-        TbTraceBbs moduleBbs;
+        BasicBlockList *moduleBbs = new BasicBlockList();
 
-        if (!BasicBlockListParser::parseListing(basicBlockList, moduleBbs)) {
+        if (!BasicBlockListParser::parseListing(basicBlockList, *moduleBbs)) {
             std::cerr << "TbTrace: could not parse basic block list in file "
                       << basicBlockList.str() << std::endl;
             exit(-1);
         }
 
-        m_basicBlocks[module] = moduleBbs;
-        bbit = m_basicBlocks.find(module);
-        assert(bbit != m_basicBlocks.end());
+        bbit = m_basicBlocks.insert(std::make_pair(module, moduleBbs)).first;
     }
 
+    disassembly = &(*it).second;
+    bbs = (*bbit).second;
+    return true;
+}
+
+void TbTrace::printDisassembly(TextBuffer &os, const std::string &module, uint64_t relPc, unsigned tbSize)
+{
+    const ModuleDisassembly *disassembly;
+    const BasicBlockList *bbs;
+    if (!getListings(module, disassembly, bbs)) {
+        return;
+    }
 
     while((int)tbSize > 0) {
         //Fetch the right basic block
-        BasicBlock bbToFetch(relPc, 1);
-        TbTraceBbs::iterator mybb = (*bbit).second.find(bbToFetch);
-        if (mybb == (*bbit).second.end()) {
-            m_output << "Could not find basic block 0x" << std::hex << relPc << " in the list" << std::endl;
+        uint32_t mybb = bbs->find(relPc);
+        if (mybb == BasicBlockList::NO_BLOCK) {
+            os << "Could not find basic block 0x" << hexNumber(relPc) << " in the list\n";
             return;
         }
 
         //Found the basic block, compute the range of program counters
         //whose disassembly we are going to print.
-        const BasicBlock &bb = *mybb;
+        BasicBlock bb(bbs->getStart(mybb), bbs->getEnd(mybb) - bbs->getStart(mybb) + 1);
         uint64_t asmStartPc = relPc;
         uint64_t asmEndPc;
 
@@ -230,19 +334,19 @@ void TbTrace::printDisassembly(const std::string &module, uint64_t relPc, unsign
 
 
         //Grab the vector of strings for the program counter
-        ModuleDisassembly::iterator modIt = (*it).second.find(asmStartPc);
-        if (modIt == (*it).second.end()) {
+        ModuleDisassembly::const_iterator modIt = disassembly->find(asmStartPc);
+        if (modIt == disassembly->end()) {
             return;
         }
 
         //Fetch the range of program counters from the disassembly file
-        ModuleDisassembly::iterator modItEnd = (*it).second.lower_bound(asmEndPc);
+        ModuleDisassembly::const_iterator modItEnd = disassembly->lower_bound(asmEndPc);
 
-        for (ModuleDisassembly::iterator it = modIt; it != modItEnd; ++it) {
+        for (ModuleDisassembly::const_iterator it = modIt; it != modItEnd; ++it) {
             //Print the vector we've got
             for(DisassemblyEntry::const_iterator asmIt = (*it).second.begin();
                 asmIt != (*it).second.end(); ++asmIt) {
-                m_output << "\033[1;33m" << *asmIt << "\033[0m" << std::endl;
+                os << "\033[1;33m" << *asmIt << "\033[0m\n";
             }
         }
 
@@ -256,21 +360,20 @@ void TbTrace::printDisassembly(const std::string &module, uint64_t relPc, unsign
 
 }
 
-void TbTrace::printDebugInfo(uint64_t pid, uint64_t pc, unsigned tbSize, bool printListing)
+void TbTrace::printDebugInfo(TbTraceBatch *batch, TextBuffer &os, const ModuleInstance *mi,
+                             uint64_t pc, unsigned tbSize, bool printListing)
 {
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
-    const ModuleInstance *mi = mcs->getInstance(pid, pc);
     if (!mi) {
         return;
     }
     uint64_t relPc = pc - mi->LoadBase + mi->ImageBase;
-    m_output << std::hex << "(" << mi->Name;
+    os << "(" << mi->Name;
     if (relPc != pc) {
-       m_output << " 0x" << relPc;
+       os << " 0x" << hexNumber(relPc);
     }
-    m_output << ")";
+    os << ")";
 
-    m_hasModuleInfo = true;
+    batch->m_hasModuleInfo = true;
 
     std::string file = "?", function="?";
     uint64_t line=0;
@@ -280,17 +383,17 @@ void TbTrace::printDebugInfo(uint64_t pid, uint64_t pc, unsigned tbSize, bool pr
             file = file.substr(pos+1);
         }
 
-        m_output << " " << file << std::dec << ":" << line << " in " << function;
-        m_hasDebugInfo = true;
+        os << " " << file << ":" << decNumber(line) << " in " << function;
+        batch->m_hasDebugInfo = true;
     }
 
     if (PrintDisassembly && printListing) {
-        m_output << std::endl;
-        printDisassembly(mi->Name, relPc, tbSize);
+        os << '\n';
+        printDisassembly(os, mi->Name, relPc, tbSize);
     }
 }
 
-void TbTrace::printRegisters(const s2e::plugins::ExecutionTraceTb *te, std::string &arch)
+void TbTrace::printRegisters(TextBuffer &os, const s2e::plugins::ExecutionTraceTb *te, std::string &arch)
 {
 
 	if (arch == "arm") {
@@ -298,27 +401,27 @@ void TbTrace::printRegisters(const s2e::plugins::ExecutionTraceTb *te, std::stri
 								"R8", "R9", "R10", "R11", "R12", "SP (R13)", "LR (R14)",};
 				for (unsigned i=0; i<15; ++i) {
 					if (te->symbMask & (1<<i)) {
-						m_output << regs[i] << ": SYMBOLIC ";
+						os << regs[i] << ": SYMBOLIC ";
 					}else {
-						m_output << regs[i] << ": 0x" << std::hex << te->registers[i] << " ";
+						os << regs[i] << ": 0x" << hexNumber(te->registers[i]) << " ";
 					}
 				}
 	} else if (arch == "i386") {
 		const char *regs[] = {"EAX", "ECX", "EDX", "EBX", "ESP", "EBP", "ESI", "EDI"};
 		for (unsigned i=0; i<8; ++i) {
 			if (te->symbMask & (1<<i)) {
-				m_output << regs[i] << ": SYMBOLIC ";
+				os << regs[i] << ": SYMBOLIC ";
 			}else {
-				m_output << regs[i] << ": 0x" << std::hex << te->registers[i] << " ";
+				os << regs[i] << ": 0x" << hexNumber(te->registers[i]) << " ";
 			}
 		}
 	} else {
-		m_output << "Unknown arch specified. Currently supported: arm, i386.";
+		os << "Unknown arch specified. Currently supported: arm, i386.";
 	}
 
 }
 
-void TbTrace::printMemoryChecker(const s2e::plugins::ExecutionTraceMemChecker::Serialized *item)
+void TbTrace::printMemoryChecker(TextBuffer &os, const s2e::plugins::ExecutionTraceMemChecker::Serialized *item)
 {
     ExecutionTraceMemChecker deserializedItem;
 
@@ -330,83 +433,127 @@ void TbTrace::printMemoryChecker(const s2e::plugins::ExecutionTraceMemChecker::S
         return;
     }
 
-    m_output << "\033[1;31mMEMCHECKER\033[0m";
+    os << "\033[1;31mMEMCHECKER\033[0m";
 
     std::string nameHighlightCode;
 
     if (deserializedItem.flags & ExecutionTraceMemChecker::REVOKE) {
         nameHighlightCode = "\033[1;31m";
-        m_output << nameHighlightCode << " REVOKE ";
+        os << nameHighlightCode << " REVOKE ";
 
     }
 
     if (deserializedItem.flags & ExecutionTraceMemChecker::GRANT) {
         nameHighlightCode = "\033[1;32m";
-        m_output << nameHighlightCode << " GRANT  ";
+        os << nameHighlightCode << " GRANT  ";
     }
 
     if (deserializedItem.flags & ExecutionTraceMemChecker::READ) {
-        m_output << " READ   ";
+        os << " READ   ";
     }
 
     if (deserializedItem.flags & ExecutionTraceMemChecker::WRITE) {
-        m_output << " WRITE  ";
+        os << " WRITE  ";
     }
 
 
 
-    m_output << nameHighlightCode << deserializedItem.name << "\033[0m";
+    os << nameHighlightCode << deserializedItem.name << "\033[0m";
 
-    m_output << " address=0x" << std::hex << deserializedItem.start
-             << " size=0x" << deserializedItem.size << std::endl;
+    os << " address=0x" << hexNumber(deserializedItem.start)
+             << " size=0x" << hexNumber(deserializedItem.size) << '\n';
 }
 
+//Copies the item into the current batch of the segment. The module of the
+//program counter depends on the state of the path, it is looked up here.
 void TbTrace::onItem(unsigned traceIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             void *item)
 {
-    //m_output << "Trace index " << std::dec << traceIndex << std::endl;
+    TbTraceState *state = static_cast<TbTraceState*>(m_events->getState(this, &TbTraceState::factory));
+
+    uint64_t pc = 0;
+    bool hasPc = true;
+    if (hdr.type == s2e::plugins::TRACE_FORK) {
+        pc = ((const s2e::plugins::ExecutionTraceFork*)item)->pc;
+    } else if (hdr.type == s2e::plugins::TRACE_TB_START) {
+        pc = ((const s2e::plugins::ExecutionTraceTb*)item)->pc;
+        state->m_hasItems = true;
+    } else if (hdr.type == s2e::plugins::TRACE_MEMORY) {
+        pc = ((const s2e::plugins::ExecutionTraceMemory*)item)->pc;
+    } else {
+        hasPc = false;
+    }
+
+    const ModuleInstance *mi = NULL;
+    if (hasPc) {
+        const ModuleCacheState *mcs = static_cast<const ModuleCacheState*>(m_events->getConstState(m_cache, &ModuleCacheState::factory));
+        mi = mcs->getInstance(hdr.pid, pc);
+    }
+
+    TbTraceBatch *batch = state->m_batches.empty() ? NULL : state->m_batches.back();
+    if (!batch || batch->m_submitted) {
+        batch = new TbTraceBatch(this);
+        state->m_batches.push_back(batch);
+    }
+
+    batch->add(hdr, item, mi);
+    if (batch->isFull()) {
+        submit(batch);
+    }
+}
+
+//Formats an item of a batch. Each item sets the base of the
+//numbers it prints, the output does not depend on other items.
+//State ids are decimal and module addresses hexadecimal. Older
+//versions printed them in the base left by the previous item.
+void TbTrace::formatItem(TbTraceBatch *batch, TextBuffer &os, const TbTraceBatch::Item &i)
+{
+    const s2e::plugins::ExecutionTraceItemHeader &hdr = i.hdr;
+    const void *item = &batch->m_data[i.offset];
+
     if (hdr.type == s2e::plugins::TRACE_MOD_LOAD) {
         const s2e::plugins::ExecutionTraceModuleLoad &load = *(s2e::plugins::ExecutionTraceModuleLoad*)item;
-        m_output << "Loaded module " << load.name
-                 << " at 0x" << std::hex << load.loadBase;
-        m_output << std::endl;
+        os << "Loaded module " << load.name
+                 << " at 0x" << hexNumber(load.loadBase);
+        os << '\n';
         return;
     }
 
     if (hdr.type == s2e::plugins::TRACE_MOD_UNLOAD) {
         const s2e::plugins::ExecutionTraceModuleUnload &unload = *(s2e::plugins::ExecutionTraceModuleUnload*)item;
-        m_output << "Unloaded module at 0x" << unload.loadBase;
-        m_output << std::endl;
+        os << "Unloaded module at 0x" << hexNumber(unload.loadBase);
+        os << '\n';
         return;
     }
 
     if (hdr.type == s2e::plugins::TRACE_PAGEFAULT) {
         const s2e::plugins::ExecutionTracePageFault &fault = *(s2e::plugins::ExecutionTracePageFault*)item;
-        m_output << "PF @" << std::hex << fault.pc << " addr=" <<  fault.address << " isWrite=" << (int) fault.isWrite;
-        m_output << std::endl;
+        os << "PF @" << hexNumber(fault.pc) << " addr=" << hexNumber(fault.address)
+           << " isWrite=" << hexNumber(fault.isWrite);
+        os << '\n';
         return;
     }
 
     if (hdr.type == s2e::plugins::TRACE_EXCEPTION) {
         const s2e::plugins::ExecutionTraceException &fault = *(s2e::plugins::ExecutionTraceException*)item;
-        m_output << "EXCP @" << std::hex << fault.pc << " vec=" <<  fault.vector;
-        m_output << std::endl;
+        os << "EXCP @" << hexNumber(fault.pc) << " vec=" << hexNumber(fault.vector);
+        os << '\n';
         return;
     }
 
     if (hdr.type == s2e::plugins::TRACE_STATE_SWITCH) {
         const s2e::plugins::ExecutionTraceStateSwitch &s = *(s2e::plugins::ExecutionTraceStateSwitch*)item;
-        m_output << "State switch " << hdr.stateId << " => " << s.newStateId;
-        m_output << std::endl;
+        os << "State switch " << decNumber(hdr.stateId) << " => " << decNumber(s.newStateId);
+        os << '\n';
         return;
     }
 
     if (hdr.type == s2e::plugins::TRACE_FORK) {
         s2e::plugins::ExecutionTraceFork *f = (s2e::plugins::ExecutionTraceFork*)item;
-        m_output << "Forked at 0x" << std::hex << f->pc << " - ";
-        printDebugInfo(hdr.pid, f->pc, 0, false);
-        m_output << std::endl;
+        os << "Forked at 0x" << hexNumber(f->pc) << " - ";
+        printDebugInfo(batch, os, i.module, f->pc, 0, false);
+        os << '\n';
         return;
     }
 
@@ -414,18 +561,17 @@ void TbTrace::onItem(unsigned traceIndex,
         const s2e::plugins::ExecutionTraceTb *te =
                 (const s2e::plugins::ExecutionTraceTb*) item;
 
-        m_output << "0x" << std::hex << te->pc<< " - ";
+        os << "0x" << hexNumber(te->pc) << " - ";
 
         if (PrintRegisters != "") {
-            m_output << std::endl << "    ";
-            printRegisters(te, PrintRegisters);
-            m_output << std::endl << "    ";
+            os << "\n    ";
+            printRegisters(os, te, PrintRegisters);
+            os << "\n    ";
         }
 
-        printDebugInfo(hdr.pid, te->pc, te->size, true);
+        printDebugInfo(batch, os, i.module, te->pc, te->size, true);
 
-        m_output << std::endl;
-        m_hasItems = true;
+        os << '\n';
         return;
     }
 
@@ -438,35 +584,120 @@ void TbTrace::onItem(unsigned traceIndex,
         type += te->flags & EXECTRACE_MEM_SYMBADDR ? "A" : "-";
         type += te->flags & EXECTRACE_MEM_SYMBVAL ? "S" : "-";
         type += te->flags & EXECTRACE_MEM_WRITE   ? "W" : "R";
-        m_output << "S=" << std::dec << hdr.stateId << " P=0x" << std::hex << hdr.pid << " PC=0x" << std::hex << te->pc << " " << type << (int)te->size << "[0x"
-                << std::hex << te->address << "]=0x" << std::setw(10) << std::setfill('0') << te->value;
+        os << "S=" << decNumber(hdr.stateId) << " P=0x" << hexNumber(hdr.pid) << " PC=0x" << hexNumber(te->pc) << " "
+           << type << hexNumber(te->size) << "[0x" << hexNumber(te->address) << "]=0x" << hexNumber(te->value, 10, '0');
 
         if (te->flags & EXECTRACE_MEM_HASHOSTADDR) {
-           m_output << " hostAddr=0x" << te->hostAddress << " ";
+           os << " hostAddr=0x" << hexNumber(te->hostAddress) << " ";
         }
 
         if (te->flags & EXECTRACE_MEM_OBJECTSTATE) {
-           m_output << " cb=0x" << te->concreteBuffer << " ";
+           os << " cb=0x" << hexNumber(te->concreteBuffer) << " ";
         }
 
-        m_output << "\t";
+        os << "\t";
 
-        printDebugInfo(hdr.pid, te->pc, 0, false);
-        m_output << std::setfill(' ');
-        m_output << std::endl;
+        printDebugInfo(batch, os, i.module, te->pc, 0, false);
+        os << '\n';
        return;
     }
 
     if (PrintMemoryChecker && (hdr.type == s2e::plugins::TRACE_MEM_CHECKER)) {
         const s2e::plugins::ExecutionTraceMemChecker::Serialized *te =
                 (const s2e::plugins::ExecutionTraceMemChecker::Serialized*) item;
-        printMemoryChecker(te);
+        printMemoryChecker(os, te);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
+ItemProcessorState *TbTraceState::factory()
+{
+    return new TbTraceState();
+}
+
+TbTraceState::TbTraceState()
+{
+    m_parent = NULL;
+    m_hasItems = false;
+}
+
+TbTraceState::~TbTraceState()
+{
+    for (unsigned i = 0; i < m_batches.size(); ++i) {
+        delete m_batches[i];
+    }
+
+    if (m_parent) {
+        m_parent->decref();
+    }
+}
+
+//The child segment continues the output of its parent
+ItemProcessorState *TbTraceState::clone() const
+{
+    TbTraceState *ret = new TbTraceState();
+    incref();
+    ret->m_parent = this;
+    ret->m_hasItems = m_hasItems;
+    return ret;
+}
+
+void TbTraceState::printTrace(std::ostream &os) const
+{
+    std::vector<const TbTraceState*> segments;
+    for (const TbTraceState *s = this; s; s = s->m_parent) {
+        segments.push_back(s);
+    }
+
+    std::vector<const TbTraceState*>::reverse_iterator it;
+    for (it = segments.rbegin(); it != segments.rend(); ++it) {
+        const std::vector<TbTraceBatch*> &batches = (*it)->m_batches;
+        for (unsigned i = 0; i < batches.size(); ++i) {
+            const std::string &str = batches[i]->m_output;
+            os.write(str.data(), str.size());
+        }
+    }
+}
+
+bool TbTraceState::hasModuleInfo() const
+{
+    for (const TbTraceState *s = this; s; s = s->m_parent) {
+        for (unsigned i = 0; i < s->m_batches.size(); ++i) {
+            if (s->m_batches[i]->m_hasModuleInfo) {
+                return true;
+            }
+        }
     }
+    return false;
 }
 
+bool TbTraceState::hasDebugInfo() const
+{
+    for (const TbTraceState *s = this; s; s = s->m_parent) {
+        for (unsigned i = 0; i < s->m_batches.size(); ++i) {
+            if (s->m_batches[i]->m_hasDebugInfo) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
 TbTraceTool::TbTraceTool()
 {
+    m_pathBuilder = NULL;
+    m_trace = NULL;
+    m_testCase = NULL;
+
     m_binaries.setPaths(ModDir);
+    m_binaries.prefetchModules(&m_parser);
 }
 
 TbTraceTool::~TbTraceTool()
@@ -477,6 +708,10 @@ TbTraceTool::~TbTraceTool()
 void TbTraceTool::flatTrace()
 {
     PathBuilder pb(&m_parser);
+    if (!pb.canReplay()) {
+        return;
+    }
+
     m_parser.parse(TraceFiles);
 
     ModuleCache mc(&pb);
@@ -494,58 +729,85 @@ void TbTraceTool::flatTrace()
         }
     }
 
-    //XXX: this is efficient only for short paths or for a small number of
-    //path, because complexity is O(n2): we reprocess the prefixes.
+    PathSet requested;
     for(listit = PathList.begin(); listit != PathList.end(); ++listit) {
-        std::cout << "Processing path " << std::dec << *listit << std::endl;
-        PathSet::iterator pit = paths.find(*listit);
-        if (pit == paths.end()) {
+        if (paths.find(*listit) == paths.end()) {
             std::cerr << "Could not find path with id " << std::dec <<
                     *listit << " in the execution trace." << std::endl;
             continue;
         }
+        requested.insert(*listit);
+    }
 
-        std::stringstream ss;
-        ss << LogDir << "/" << *listit << ".txt";
-        std::ofstream traceFile(ss.str().c_str());
+    //Process all the paths in one pass. The common prefixes are rendered
+    //only once, each path is the concatenation of the output of its segments.
+    //Each path is written as soon as it is complete, the output that no
+    //remaining path shares is freed right away.
+    TbTrace trace(&m_binaries, &mc, &pb);
+    m_pathBuilder = &pb;
+    m_trace = &trace;
+    m_testCase = &tc;
+
+    sigc::connection connection = pb.onPathProcessed.connect(
+            sigc::mem_fun(*this, &TbTraceTool::outputPath)
+    );
+
+    pb.processPaths(requested);
+
+    connection.disconnect();
+    m_pathBuilder = NULL;
+    m_trace = NULL;
+    m_testCase = NULL;
+}
 
-        TbTrace trace(&m_binaries, &mc, &pb, traceFile);
+void TbTraceTool::outputPath(uint32_t pathId)
+{
+    std::cout << "Processing path " << std::dec << pathId << std::endl;
 
-        if (!pb.processPath(*listit)) {
-            std::cerr << "Could not process path " << std::dec << *listit << std::endl;
-            continue;
-        }
+    std::stringstream ss;
+    ss << LogDir << "/" << pathId << ".txt";
+    std::ofstream traceFile(ss.str().c_str());
 
-        traceFile << "----------------------" << std::endl;
+    TbTraceState *state = static_cast<TbTraceState*>(m_pathBuilder->getState(m_trace, pathId));
+    TbTraceState empty;
+    if (!state) {
+        state = &empty;
+    }
 
-        if (trace.hasDebugInfo() == false) {
-            traceFile << "WARNING: No debug information for any module in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure you have set the module path properly and the binaries contain debug information."
-                    << std::endl << std::endl;
-        }
+    m_trace->flush(state);
+    state->printTrace(traceFile);
 
-        if (trace.hasModuleInfo() == false) {
-            traceFile << "WARNING: No module information for any module in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure to use the ModuleTracer plugin before running this tool."
-                    << std::endl << std::endl;
-        }
+    traceFile << "----------------------" << std::endl;
 
-        if (trace.hasItems() == false ) {
-            traceFile << "WARNING: No basic blocks in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure to use the TranslationBlockTracer plugin before running this tool. "
-                    << std::endl << std::endl;
-        }
+    if (state->hasDebugInfo() == false) {
+        traceFile << "WARNING: No debug information for any module in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure you have set the module path properly and the binaries contain debug information."
+                << std::endl << std::endl;
+    }
 
-        TestCaseState *tcs = static_cast<TestCaseState*>(pb.getState(&tc, *pit));
-        if (!tcs) {
-            traceFile << "WARNING: No test case in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure to use the TestCaseGenerator plugin and terminate the states before running this tool. "
-                    << std::endl << std::endl;
-        }else {
-            tcs->printInputs(traceFile);
-        }
+    if (state->hasModuleInfo() == false) {
+        traceFile << "WARNING: No module information for any module in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure to use the ModuleTracer plugin before running this tool."
+                << std::endl << std::endl;
+    }
+
+    if (state->hasItems() == false ) {
+        traceFile << "WARNING: No basic blocks in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure to use the TranslationBlockTracer plugin before running this tool. "
+                << std::endl << std::endl;
+    }
+
+    TestCaseState *tcs = static_cast<TestCaseState*>(m_pathBuilder->getState(m_testCase, pathId));
+    if (!tcs) {
+        traceFile << "WARNING: No test case in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure to use the TestCaseGenerator plugin and terminate the states before running this tool. "
+                << std::endl << std::endl;
+    }else {
+        tcs->printInputs(traceFile);
     }
 
+    //The segments of the path that no other path shares are freed with it
+    m_pathBuilder->releasePath(pathId);
 }
 
 }
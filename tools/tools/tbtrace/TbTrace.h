@@ -41,13 +41,68 @@
 
 #include <ostream>
 #include <fstream>
+#include <sstream>
 
 #include <lib/BinaryReaders/Library.h>
 #include <lib/Utils/BasicBlockListParser.h>
+#include <lib/Utils/TextBuffer.h>
+#include <lib/Utils/ThreadPool.h>
+
+#include "llvm/Support/Mutex.h"
 
 namespace s2etools
 {
 
+class TbTrace;
+class TbTraceState;
+class PathBuilder;
+class TestCase;
+
+/**
+ *  Consecutive items of a path segment. The items are copied by the thread
+ *  that reads the trace, along with the module they belong to, and are
+ *  formatted into text later on, possibly by a worker thread.
+ */
+class TbTraceBatch: public ThreadPoolTask
+{
+public:
+    //Size of the copied items above which the batch is formatted
+    static const unsigned MAX_SIZE = 256 * 1024;
+
+    struct Item {
+        s2e::plugins::ExecutionTraceItemHeader hdr;
+        const ModuleInstance *module;
+        unsigned offset;
+    };
+
+private:
+    TbTrace *m_trace;
+    std::vector<Item> m_items;
+
+    //8-byte aligned copies of the items
+    std::vector<uint64_t> m_data;
+
+    std::string m_output;
+    bool m_submitted;
+    bool m_hasModuleInfo;
+    bool m_hasDebugInfo;
+
+public:
+    TbTraceBatch(TbTrace *trace);
+
+    void add(const s2e::plugins::ExecutionTraceItemHeader &hdr,
+             const void *item, const ModuleInstance *module);
+
+    bool isFull() const {
+        return m_data.size() * sizeof(uint64_t) >= MAX_SIZE;
+    }
+
+    void run();
+
+    friend class TbTrace;
+    friend class TbTraceState;
+};
+
 class TbTrace
 {
 public:
@@ -59,11 +114,8 @@ public:
 
     typedef std::map<std::string, ModuleDisassembly> Disassembly;
 
-    //Convenient definition of basic blocks
-    typedef BasicBlockListParser::BasicBlocks TbTraceBbs;
-
     //Gathers all the basic blocks contained in a module
-    typedef std::map<std::string, TbTraceBbs> ModuleBasicBlocks;
+    typedef std::map<std::string, BasicBlockList*> ModuleBasicBlocks;
 
 private:
     LogEvents *m_events;
@@ -71,41 +123,78 @@ private:
     Library *m_library;
     Disassembly m_disassembly;
     ModuleBasicBlocks m_basicBlocks;
-    std::ofstream &m_output;
 
-    sigc::connection m_connection;
+    //Protects the listings, which are loaded by the formatting threads
+    llvm::sys::Mutex m_listingLock;
 
-    bool m_hasItems;
-    bool m_hasModuleInfo;
-    bool m_hasDebugInfo;
+    //Batches are formatted in parallel if there are several threads.
+    //They belong to the states, which must not be released before
+    //their batches are formatted (see flush()).
+    ThreadPool *m_pool;
+
+    void submit(TbTraceBatch *batch);
 
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
                 void *item);
 
     bool parseDisassembly(const std::string &listingFile, Disassembly &out);
-    void printDisassembly(const std::string &module, uint64_t relPc, unsigned tbSize);
-
-    void printDebugInfo(uint64_t pid, uint64_t pc, unsigned tbSize, bool printListing);
-    void printRegisters(const s2e::plugins::ExecutionTraceTb *te, std::string &arch);
-    void printMemoryChecker(const s2e::plugins::ExecutionTraceMemChecker::Serialized *item);
+    bool getListings(const std::string &module, const ModuleDisassembly *&disassembly,
+                     const BasicBlockList *&bbs);
+    void printDisassembly(TextBuffer &os, const std::string &module, uint64_t relPc, unsigned tbSize);
+
+    void formatItem(TbTraceBatch *batch, TextBuffer &os, const TbTraceBatch::Item &item);
+    void printDebugInfo(TbTraceBatch *batch, TextBuffer &os, const ModuleInstance *mi,
+                        uint64_t pc, unsigned tbSize, bool printListing);
+    void printRegisters(TextBuffer &os, const s2e::plugins::ExecutionTraceTb *te, std::string &arch);
+    void printMemoryChecker(TextBuffer &os, const s2e::plugins::ExecutionTraceMemChecker::Serialized *item);
 public:
-    TbTrace(Library *lib, ModuleCache *cache, LogEvents *events, std::ofstream &ofs);
+    TbTrace(Library *lib, ModuleCache *cache, LogEvents *events);
     virtual ~TbTrace();
 
+    //Formats the remaining batches of the path that ends with the given
+    //state and waits for all the batches. Must be called before printing
+    //the path or releasing its state.
+    void flush(const TbTraceState *state);
+
     void outputTraces(const std::string &Path) const;
+
+    friend class TbTraceBatch;
+};
+
+/**
+ *  Output of one path segment, made of the output of its batches. The
+ *  output of a path is the concatenation of the output of all the
+ *  segments from the root to its leaf. The batches are freed with the
+ *  state, once no path needs them anymore.
+ */
+class TbTraceState: public ItemProcessorState
+{
+private:
+    const TbTraceState *m_parent;
+    std::vector<TbTraceBatch*> m_batches;
+
+    bool m_hasItems;
+
+public:
+    TbTraceState();
+    virtual ~TbTraceState();
+
+    static ItemProcessorState *factory();
+    virtual ItemProcessorState *clone() const;
+
+    //Prints the output of the whole path
+    void printTrace(std::ostream &os) const;
+
     bool hasItems() const {
         return m_hasItems;
     }
 
-    bool hasModuleInfo() const {
-        return m_hasModuleInfo;
-    }
-
-    bool hasDebugInfo() const {
-        return m_hasDebugInfo;
-    }
+    //Whether any item of the path had module or debug information
+    bool hasModuleInfo() const;
+    bool hasDebugInfo() const;
 
+    friend class TbTrace;
 };
 
 class TbTraceTool
@@ -115,6 +204,13 @@ private:
 
     Library m_binaries;
 
+    //Set while flatTrace() runs
+    PathBuilder *m_pathBuilder;
+    TbTrace *m_trace;
+    TestCase *m_testCase;
+
+    void outputPath(uint32_t pathId);
+
 public:
     TbTraceTool();
     ~TbTraceTool();
@@ -0,0 +1,85 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "llvm/Support/CommandLine.h"
+
+#include <lib/ExecutionTracer/LogParser.h>
+#include <lib/ExecutionTracer/ColumnarTrace.h>
+
+#include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+
+#include <iostream>
+
+using namespace llvm;
+using namespace s2etools;
+
+namespace {
+
+cl::list<std::string>
+    TraceFiles("trace", llvm::cl::value_desc("Input trace"), llvm::cl::Prefix,
+               llvm::cl::desc("Specify an execution trace file"));
+
+cl::opt<std::string>
+    LogDir("outputdir", cl::desc("Store the column files into the given folder"), cl::init("."));
+
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " tracecolumns");
+
+    //The items are exported in one forward pass, no need for random access.
+    //The index of such a pass would replace the one of the other tools.
+    LogParser parser;
+    parser.setCheckpointInterval(0);
+    parser.setSaveIndex(false);
+
+    ColumnarTraceWriter writer(&parser);
+    if (!writer.open(LogDir)) {
+        return -1;
+    }
+
+    parser.parse(TraceFiles);
+
+    if (!writer.close()) {
+        std::cerr << "Could not write the column files to " << LogDir << std::endl;
+        return -1;
+    }
+
+    std::cout << "Exported " << writer.getItemCount(s2e::plugins::TRACE_TB_START) << " TB_START, "
+              << writer.getItemCount(s2e::plugins::TRACE_MEMORY) << " MEMORY and "
+              << writer.getModuleItemCount() << " module items" << std::endl;
+    return 0;
+}
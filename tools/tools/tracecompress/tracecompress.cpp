@@ -0,0 +1,180 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "llvm/Support/CommandLine.h"
+
+#include <lib/ExecutionTracer/LogParser.h>
+#include <lib/ExecutionTracer/TraceContainer.h>
+
+#include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+
+#include <stdio.h>
+#include <iostream>
+
+using namespace llvm;
+using namespace s2etools;
+
+namespace {
+
+cl::list<std::string>
+    TraceFiles("trace", llvm::cl::value_desc("Input trace"), llvm::cl::Prefix,
+               llvm::cl::desc("Specify an execution trace file, raw or compressed"));
+
+cl::opt<std::string>
+    OutputFile("outputfile", cl::desc("File that receives the concatenated traces"), cl::Required);
+
+cl::opt<unsigned>
+    BlockSize("blocksize", cl::desc("Size of the uncompressed blocks, in KB"), cl::init(1024));
+
+cl::opt<int>
+    Level("level", cl::desc("zlib compression level (1-9)"), cl::init(6));
+
+cl::opt<bool>
+    Decompress("decompress", cl::desc("Write a raw trace instead of a compressed one"), cl::init(false));
+
+}
+
+namespace s2etools
+{
+
+//Copies every item of the input traces to the output file
+class TraceConverter
+{
+private:
+    sigc::connection m_connection;
+    TraceContainerWriter m_container;
+    FILE *m_raw;
+    uint64_t m_rawSize;
+    bool m_ok;
+
+    void onItem(unsigned traceIndex,
+                const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                void *item)
+    {
+        if (!m_ok) {
+            return;
+        }
+
+        if (m_raw) {
+            m_ok = fwrite(&hdr, sizeof(hdr), 1, m_raw) == 1 &&
+                   (hdr.size == 0 || fwrite(item, hdr.size, 1, m_raw) == 1);
+            m_rawSize += sizeof(hdr) + hdr.size;
+        } else {
+            m_ok = m_container.addItem(hdr, item);
+        }
+    }
+
+public:
+    TraceConverter(LogEvents *events, unsigned blockSize, int level):
+            m_container(blockSize, level)
+    {
+        m_connection = events->onEachItem.connect(
+                sigc::mem_fun(*this, &TraceConverter::onItem));
+        m_raw = NULL;
+        m_rawSize = 0;
+        m_ok = true;
+    }
+
+    ~TraceConverter()
+    {
+        m_connection.disconnect();
+        if (m_raw) {
+            fclose(m_raw);
+        }
+    }
+
+    bool open(const std::string &fileName, bool raw)
+    {
+        if (raw) {
+            m_raw = fopen(fileName.c_str(), "wb");
+            return m_raw != NULL;
+        }
+        return m_container.open(fileName);
+    }
+
+    bool close()
+    {
+        if (m_raw) {
+            m_ok = (fclose(m_raw) == 0) && m_ok;
+            m_raw = NULL;
+            return m_ok;
+        }
+        return m_container.close() && m_ok;
+    }
+
+    void printStats(std::ostream &os) const
+    {
+        if (Decompress) {
+            os << "Wrote " << m_rawSize << " bytes" << std::endl;
+        } else {
+            os << "Compressed " << m_container.getRawSize() << " bytes to "
+               << m_container.getFileSize() << " bytes" << std::endl;
+        }
+    }
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " tracecompress");
+
+    if (BlockSize == 0) {
+        std::cerr << "The block size must not be 0" << std::endl;
+        return -1;
+    }
+
+    //The items are copied in one forward pass, no need for random access.
+    //The index of such a pass would replace the one of the other tools.
+    LogParser parser;
+    parser.setCheckpointInterval(0);
+    parser.setSaveIndex(false);
+
+    TraceConverter converter(&parser, BlockSize * 1024, Level);
+    if (!converter.open(OutputFile, Decompress)) {
+        std::cerr << "Could not open " << OutputFile << std::endl;
+        return -1;
+    }
+
+    parser.parse(TraceFiles);
+
+    if (!converter.close()) {
+        std::cerr << "Could not write " << OutputFile << std::endl;
+        return -1;
+    }
+
+    converter.printStats(std::cout);
+    return 0;
+}